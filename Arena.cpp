@@ -0,0 +1,59 @@
+#include "Arena.h"
+
+#include <algorithm>
+
+void Arena::reset(size_t capacity) {
+    capacity = align(capacity);
+
+    if (chunks.size() != 1 || chunks[0].size < capacity) {
+        chunks.clear();
+
+        if (capacity > 0)
+            addChunk(capacity);
+    }
+
+    chunkUsed = 0;
+    usedBytes = 0;
+}
+
+void Arena::release() {
+    chunks.clear();
+    chunkUsed = 0;
+    usedBytes = 0;
+}
+
+void* Arena::allocate(size_t size) {
+    size = align(size);
+
+    if (chunks.empty() || chunks.back().size - chunkUsed < size)
+        addChunk(std::max(size, chunks.empty() ? size : chunks.back().size));
+
+    void* region = chunks.back().data + chunkUsed;
+    chunkUsed += size;
+    usedBytes += size;
+    peakBytes = std::max(peakBytes, usedBytes);
+
+    return region;
+}
+
+size_t Arena::capacity() const {
+    size_t total = 0;
+
+    for (const Chunk& chunk : chunks) {
+        total += chunk.size;
+    }
+
+    return total;
+}
+
+void Arena::addChunk(size_t size) {
+    Chunk chunk;
+    chunk.storage.reset(new uint8_t[size + Alignment - 1]);
+    chunk.size = size;
+
+    const uintptr_t address = reinterpret_cast<uintptr_t>(chunk.storage.get());
+    chunk.data = chunk.storage.get() + (Alignment - address % Alignment) % Alignment;
+
+    chunks.push_back(std::move(chunk));
+    chunkUsed = 0;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// monotonic allocator: hands out Alignment-aligned regions of one chunk sized up front and frees them all at once,
+// a request that doesn't fit (a low estimate) gets a chunk of its own instead of moving earlier regions
+class Arena {
+public:
+    const static size_t Alignment = 64; // one cache line, one AVX-512 register
+
+    Arena() = default;
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    static size_t align(size_t size) { return (size + Alignment - 1) / Alignment * Alignment; }
+
+    // drops all regions and makes capacity bytes available as a single chunk (kept if it is large enough already)
+    void reset(size_t capacity);
+    // drops all regions and frees the chunks
+    void release();
+    void* allocate(size_t size);
+
+    size_t capacity() const;
+    size_t highWaterMark() const { return peakBytes; } // most bytes in use at once since construction
+
+private:
+    struct Chunk {
+        std::unique_ptr<uint8_t[]> storage;
+        uint8_t* data; // storage rounded up to Alignment
+        size_t size;
+    };
+
+    void addChunk(size_t size);
+
+    std::vector<Chunk> chunks;
+    size_t chunkUsed = 0; // bytes handed out from chunks.back()
+    size_t usedBytes = 0;
+    size_t peakBytes = 0;
+};
+
+// lets a std::vector live in an Arena; deallocate is a no-op, the memory returns with Arena::reset or release
+template <typename T>
+struct ArenaAllocator {
+    typedef T value_type;
+
+    Arena* arena;
+
+    explicit ArenaAllocator(Arena* arena) : arena(arena) {}
+    template <typename U> ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(size_t n) { return static_cast<T*>(arena->allocate(n * sizeof(T))); }
+    void deallocate(T*, size_t) {}
+
+    template <typename U> bool operator==(const ArenaAllocator<U>& other) const { return arena == other.arena; }
+    template <typename U> bool operator!=(const ArenaAllocator<U>& other) const { return arena != other.arena; }
+};
@@ -3,6 +3,8 @@
 
 #include "Encoder.h"
 #include "Writer.h"
+#include "FixedPoint.h"
+#include "Simd.h"
 #include "stb_image.h"
 
 #include <algorithm>
@@ -43,8 +45,82 @@ const int Encoder::ZigZagTable[64] = {
         53, 60, 61, 54, 47, 55, 62, 63      // 35, 36, 48, 49, 57, 58, 62, 63
 };
 
-Encoder::Encoder() {
-    generateCosineTable();
+// rows: Y, Cb, Cr; columns: R, G, B (JFIF)
+const double Encoder::ColorConversionMatrix[9] = {
+         0.299,     0.587,     0.114,
+        -0.168935, -0.331665,  0.50059,
+         0.499813, -0.418531, -0.081282
+};
+
+// generated once at startup instead of in every Encoder
+const std::array<double, 64> Encoder::CosineTable = Encoder::generateCosineTable();
+const std::array<int16_t, 9> Encoder::ColorConversionCoefficients = Encoder::generateColorConversionCoefficients();
+const std::array<int32_t, 9 * 256> Encoder::ColorConversionTable = Encoder::generateColorConversionTable();
+const std::array<float, 64> Encoder::AANLuminanceScaleTable = Encoder::generateAANScaleTable(LuminanceQuantizationTable);
+const std::array<float, 64> Encoder::AANChrominanceScaleTable = Encoder::generateAANScaleTable(ChrominanceQuantizationTable);
+const Simd::Divisors Encoder::LuminanceDivisors = Encoder::generateDivisors(LuminanceQuantizationTable);
+const Simd::Divisors Encoder::ChrominanceDivisors = Encoder::generateDivisors(ChrominanceQuantizationTable);
+const Simd::Divisors Encoder::FastIntegerLuminanceDivisors =
+        Encoder::generateDivisors(Encoder::generateFastIntegerDivisorTable(LuminanceQuantizationTable).data());
+const Simd::Divisors Encoder::FastIntegerChrominanceDivisors =
+        Encoder::generateDivisors(Encoder::generateFastIntegerDivisorTable(ChrominanceQuantizationTable).data());
+
+template <>
+struct Encoder::Tables<Encoder::Luminance> {
+    static const int* quantization() { return LuminanceQuantizationTable; }
+    static const Simd::Divisors& divisors() { return LuminanceDivisors; }
+    static const std::array<float, 64>& aanScale() { return AANLuminanceScaleTable; }
+    static const Simd::Divisors& fastIntegerDivisors() { return FastIntegerLuminanceDivisors; }
+};
+
+template <>
+struct Encoder::Tables<Encoder::Chrominance> {
+    static const int* quantization() { return ChrominanceQuantizationTable; }
+    static const Simd::Divisors& divisors() { return ChrominanceDivisors; }
+    static const std::array<float, 64>& aanScale() { return AANChrominanceScaleTable; }
+    static const Simd::Divisors& fastIntegerDivisors() { return FastIntegerChrominanceDivisors; }
+};
+
+void Encoder::setColorConversion(ColorConversion conversion) {
+    colorConversion = conversion;
+}
+
+void Encoder::setChromaSubsampling(ChromaSubsampling subsampling) {
+    chromaSubsampling = subsampling;
+}
+
+void Encoder::setDCTMethod(DCTMethod method) {
+    dctMethod = method;
+}
+
+// the fastest method of each arithmetic precision
+void Encoder::setDCTPrecision(DCTPrecision precision) {
+    switch (precision) {
+        case FloatPrecision:
+            dctMethod = AANDCT;
+            break;
+        case Fixed32Precision:
+            dctMethod = IntegerDCT;
+            break;
+        case Fixed16Precision:
+            dctMethod = FastIntegerDCT;
+            break;
+        default:
+            dctMethod = SeparableDCT;
+            break;
+    }
+}
+
+void Encoder::setBatchedDCT(bool batched) {
+    batchedDCT = batched;
+}
+
+void Encoder::setRowStride(size_t stride) {
+    rowStride = stride;
+}
+
+void Encoder::setVerbose(bool enabled) {
+    verbose = enabled;
 }
 
 int Encoder::round(const double num) {
@@ -66,19 +142,136 @@ unsigned int Encoder::getIndex(unsigned int x, unsigned int y, unsigned int widt
 Encoder::YCbCr Encoder::RGBToYCbCr(const Encoder::RGB& in) {
     YCbCr out;
 
-    out.y = clamp(round((0.299 * in.r) + (0.587 * in.g) + (0.114 * in.b)), 0, 255);
-    out.cb = clamp(round((-0.168935 * in.r) + (-0.331665 * in.g) + (0.50059 * in.b) + 128), 0, 255);
-    out.cr = clamp(round((0.499813 * in.r) + (-0.418531 * in.g) + (-0.081282 * in.b) + 128), 0, 255);
+    const double* m = ColorConversionMatrix;
+
+    out.y = clamp(round((m[0] * in.r) + (m[1] * in.g) + (m[2] * in.b)), 0, 255);
+    out.cb = clamp(round((m[3] * in.r) + (m[4] * in.g) + (m[5] * in.b) + 128), 0, 255);
+    out.cr = clamp(round((m[6] * in.r) + (m[7] * in.g) + (m[8] * in.b) + 128), 0, 255);
 
     return out;
 }
 
-void Encoder::generateCosineTable() {
+std::array<int16_t, 9> Encoder::generateColorConversionCoefficients() {
+    std::array<int16_t, 9> coefficients{};
+
+    for (unsigned int k = 0; k < 9; k++) {
+        coefficients[k] = (int16_t)round(ColorConversionMatrix[k] * (1 << FixedPoint::ColorConstBits));
+    }
+
+    return coefficients;
+}
+
+// nine tables of 256 entries, table 3 * row + column holds ColorConversionCoefficients[3 * row + column] * value;
+// the blue tables also carry the +128 chroma offset and the rounding bias, so a conversion is three additions per channel
+// (the products are exact, so the SIMD color kernels compute the very same sums)
+std::array<int32_t, 9 * 256> Encoder::generateColorConversionTable() {
+    using namespace FixedPoint;
+    std::array<int32_t, 9 * 256> table{};
+
+    for (unsigned int k = 0; k < 9; k++) {
+        const bool blue = k % 3 == 2;
+        const int32_t offset = (k >= 3 ? 128 << ColorConstBits : 0) + (1 << (ColorConstBits - 1));
+
+        for (int value = 0; value < 256; value++) {
+            table[256 * k + value] = ColorConversionCoefficients[k] * value + (blue ? offset : 0);
+        }
+    }
+
+    return table;
+}
+
+// same result as RGBToYCbCr within +-1 (0.34% of the channel values over all 2^24 colors are off by one)
+Encoder::YCbCr Encoder::RGBToYCbCrWithTable(const Encoder::RGB& in) {
+    using FixedPoint::ColorConstBits;
+    const int32_t* table = ColorConversionTable.data();
+    YCbCr out;
+
+    out.y = clamp((table[0*256 + in.r] + table[1*256 + in.g] + table[2*256 + in.b]) >> ColorConstBits, 0, 255);
+    out.cb = clamp((table[3*256 + in.r] + table[4*256 + in.g] + table[5*256 + in.b]) >> ColorConstBits, 0, 255);
+    out.cr = clamp((table[6*256 + in.r] + table[7*256 + in.g] + table[8*256 + in.b]) >> ColorConstBits, 0, 255);
+
+    return out;
+}
+
+std::array<double, 64> Encoder::generateCosineTable() {
+    std::array<double, 64> cosineTable{};
+
     for (unsigned int i = 0; i < 8; i++) {
         for (unsigned int j = 0; j < 8; j++) {
             cosineTable[getIndex(i, j, 8)] = std::cos((double)((2*i+1)*j*PI)/(double)(2*8));
         }
     }
+
+    return cosineTable;
+}
+
+// the AAN DCT (and the ifast DCT) leaves coefficient (i, j) scaled by 8 * s(i) * s(j)
+double Encoder::aanScaleFactor(unsigned int k) {
+    return k == 0 ? 1 : sqrt(2) * std::cos(k * PI / 16);
+}
+
+// the AAN output scaling is folded into the quantizer: each table stores 1 / (8 * s(i) * s(j) * q(i, j))
+std::array<float, 64> Encoder::generateAANScaleTable(const int* quantizationTable) {
+    std::array<float, 64> scaleTable{};
+
+    for (unsigned int i = 0; i < 8; i++) {
+        for (unsigned int j = 0; j < 8; j++) {
+            const double scale = 8 * aanScaleFactor(i) * aanScaleFactor(j);
+            scaleTable[getIndex(i, j, 8)] = (float)(1 / (scale * quantizationTable[getIndex(i, j, 8)]));
+        }
+    }
+
+    return scaleTable;
+}
+
+// round(x / q) == floor((2x + q) / 2q), so every table entry stores ceil(2^32 / 2q)
+// and quantizeBlockWithReciprocals can replace the division with a multiply and a shift
+// the 16-bit variant rounds like the 32-bit one: (2|x| + d - (x < 0)) / 2d = (|x| + (d - (x < 0)) / 2) / d;
+// with b = floor(log2 d), n / d = (n + c) * multiplier >> (16 + b) for every 16-bit n, where the multiplier is
+// 2^(16 + b) / d rounded up if that is accurate enough and rounded down with the correction c = 1 otherwise
+Simd::Divisors Encoder::generateDivisors(const int* divisorTable) {
+    Simd::Divisors divisors{};
+
+    for (unsigned int i = 0; i < 64; i++) {
+        const uint32_t d = divisorTable[i];
+        unsigned int b = 0;
+        while ((2u << b) <= d) {
+            b++;
+        }
+
+        uint32_t multiplier = (1u << (16 + b)) / d + 1;
+        uint32_t correction = 0;
+        if ((d & (d - 1)) == 0) {
+            multiplier = 0xFFFF;
+            correction = 1;
+        } else if (multiplier * d - (1u << (16 + b)) > (1u << b)) {
+            multiplier--;
+            correction = 1;
+        }
+
+        divisors.divisor[i] = d;
+        divisors.reciprocal[i] = (uint32_t)(((uint64_t)1 << 32) / (2 * d) + 1);
+        divisors.bias[i] = (uint16_t)(d / 2 + correction);
+        divisors.negativeBias[i] = d % 2 == 0 ? 0xFFFF : 0;
+        divisors.multiplier[i] = (uint16_t)multiplier;
+        divisors.scale[i] = (uint16_t)(1u << (16 - b));
+    }
+
+    return divisors;
+}
+
+// the ifast DCT has the same output scaling as the AAN DCT, here it becomes part of integer divisors
+// round(8 * s(i) * s(j) * q(i, j)) that the reciprocal quantizer can use like any other quantization table
+std::array<int, 64> Encoder::generateFastIntegerDivisorTable(const int* quantizationTable) {
+    std::array<int, 64> divisorTable{};
+
+    for (unsigned int i = 0; i < 8; i++) {
+        for (unsigned int j = 0; j < 8; j++) {
+            divisorTable[getIndex(i, j, 8)] = round(8 * aanScaleFactor(i) * aanScaleFactor(j) * quantizationTable[getIndex(i, j, 8)]);
+        }
+    }
+
+    return divisorTable;
 }
 
 double Encoder::C(unsigned int x) {
@@ -90,15 +283,15 @@ double Encoder::C(unsigned int x) {
     return 1;
 }
 
-int Encoder::calcDCTCoefficient(unsigned int i, unsigned int j, const std::array<int, 64>& block) {
+int Encoder::calcDCTCoefficient(unsigned int i, unsigned int j, const Block& block) {
     static const double inverseSqrtOfSixteen = (double)1 / sqrt(16);
     double temp = 0;
 
     for (unsigned int x = 0; x < 8; x++) {
         for (unsigned int y = 0; y < 8; y++) {
             temp += (block[getIndex(x, y, 8)] - 128)
-                    * cosineTable[getIndex(x, i, 8)]
-                    * cosineTable[getIndex(y, j, 8)];
+                    * CosineTable[getIndex(x, i, 8)]
+                    * CosineTable[getIndex(y, j, 8)];
         }
     }
 
@@ -107,8 +300,8 @@ int Encoder::calcDCTCoefficient(unsigned int i, unsigned int j, const std::array
     return round(temp);
 }
 
-void Encoder::transformBlockWithDCT(std::array<int, 64> &block) {
-    std::array<int, 64> transformed{};
+void Encoder::transformBlockWithDCT(Block &block) {
+    Block transformed{};
 
     for (unsigned int i = 0; i < 8; i++) {
         for (unsigned int j = 0; j < 8; j++) {
@@ -119,9 +312,205 @@ void Encoder::transformBlockWithDCT(std::array<int, 64> &block) {
     block = transformed;
 }
 
-void Encoder::quantizeBlock(std::array<int, 64> &block, PixelType type) {
-    std::array<int, 64> quantized{};
-    const int* table = type == Luminance ? LuminanceQuantizationTable : ChrominanceQuantizationTable;
+// same transform as transformBlockWithDCT, split into a 1-D pass over every row followed by a 1-D pass
+// over every column, which takes 2 * 512 multiply-adds per block instead of 4096
+void Encoder::transformBlockWithSeparableDCT(Block &block) {
+    static const double inverseSqrtOfSixteen = (double)1 / sqrt(16);
+    std::array<double, 64> rows{};
+
+    // row pass: horizontal frequency i for every row y
+    for (unsigned int y = 0; y < 8; y++) {
+        for (unsigned int i = 0; i < 8; i++) {
+            double temp = 0;
+
+            for (unsigned int x = 0; x < 8; x++) {
+                temp += (block[getIndex(x, y, 8)] - 128) * CosineTable[getIndex(x, i, 8)];
+            }
+
+            rows[getIndex(i, y, 8)] = temp;
+        }
+    }
+
+    // column pass: vertical frequency j for every horizontal frequency i
+    for (unsigned int i = 0; i < 8; i++) {
+        for (unsigned int j = 0; j < 8; j++) {
+            double temp = 0;
+
+            for (unsigned int y = 0; y < 8; y++) {
+                temp += rows[getIndex(i, y, 8)] * CosineTable[getIndex(y, j, 8)];
+            }
+
+            block[getIndex(i, j, 8)] = round(temp * inverseSqrtOfSixteen * C(i) * C(j));
+        }
+    }
+}
+
+// one 1-D pass of the Arai-Agui-Nakajima DCT (5 multiplies), reading and writing every stride-th value of data
+static void aanPass(float* data, unsigned int stride) {
+    float* d[8];
+    for (unsigned int k = 0; k < 8; k++) {
+        d[k] = data + k * stride;
+    }
+
+    const float tmp0 = *d[0] + *d[7];
+    const float tmp7 = *d[0] - *d[7];
+    const float tmp1 = *d[1] + *d[6];
+    const float tmp6 = *d[1] - *d[6];
+    const float tmp2 = *d[2] + *d[5];
+    const float tmp5 = *d[2] - *d[5];
+    const float tmp3 = *d[3] + *d[4];
+    const float tmp4 = *d[3] - *d[4];
+
+    // even part
+    const float tmp10 = tmp0 + tmp3;
+    const float tmp13 = tmp0 - tmp3;
+    const float tmp11 = tmp1 + tmp2;
+    const float tmp12 = tmp1 - tmp2;
+
+    *d[0] = tmp10 + tmp11;
+    *d[4] = tmp10 - tmp11;
+
+    const float z1 = (tmp12 + tmp13) * 0.707106781f;
+    *d[2] = tmp13 + z1;
+    *d[6] = tmp13 - z1;
+
+    // odd part
+    const float odd10 = tmp4 + tmp5;
+    const float odd11 = tmp5 + tmp6;
+    const float odd12 = tmp6 + tmp7;
+
+    const float z5 = (odd10 - odd12) * 0.382683433f;
+    const float z2 = 0.541196100f * odd10 + z5;
+    const float z4 = 1.306562965f * odd12 + z5;
+    const float z3 = odd11 * 0.707106781f;
+
+    const float z11 = tmp7 + z3;
+    const float z13 = tmp7 - z3;
+
+    *d[5] = z13 + z2;
+    *d[3] = z13 - z2;
+    *d[1] = z11 + z4;
+    *d[7] = z11 - z4;
+}
+
+// the AAN DCT, every output multiplied by its entry of scale and rounded
+void Encoder::transformBlockWithAANDCT(Block &block, const std::array<float, 64>& scale) {
+    std::array<float, 64> data{};
+
+    for (unsigned int i = 0; i < 64; i++) {
+        data[i] = (float)(block[i] - 128);
+    }
+
+    for (unsigned int y = 0; y < 8; y++) {
+        aanPass(&data[getIndex(0, y, 8)], 1);
+    }
+
+    for (unsigned int x = 0; x < 8; x++) {
+        aanPass(&data[getIndex(x, 0, 8)], 8);
+    }
+
+    for (unsigned int i = 0; i < 64; i++) {
+        block[i] = round(data[i] * scale[i]);
+    }
+}
+
+// DCT and quantization in one step: the AAN output scaling is already part of the AAN scale tables
+template <Encoder::PixelType type>
+void Encoder::transformAndQuantizeBlockWithAANDCT(Block &block) {
+    transformBlockWithAANDCT(block, Tables<type>::aanScale());
+}
+
+namespace {
+    using namespace FixedPoint;
+
+    // one 1-D pass of the Loeffler-Ligtenberg-Moschytz DCT (12 multiplies) in integer arithmetic
+    // the row pass keeps DCTPass1Bits extra bits of precision, the column pass removes them again together
+    // with the factor 8 of the unnormalized transform, so the result has the same scale as calcDCTCoefficient
+    void integerDCTPass(int32_t* data, unsigned int stride, bool rowPass) {
+        const int evenShift = rowPass ? 0 : DCTPass1Bits + 3;
+        const int oddShift = rowPass ? DCTConstBits - DCTPass1Bits : DCTConstBits + DCTPass1Bits + 3;
+        int32_t* d[8];
+        for (unsigned int k = 0; k < 8; k++) {
+            d[k] = data + k * stride;
+        }
+
+        int32_t tmp0 = *d[0] + *d[7];
+        int32_t tmp7 = *d[0] - *d[7];
+        int32_t tmp1 = *d[1] + *d[6];
+        int32_t tmp6 = *d[1] - *d[6];
+        int32_t tmp2 = *d[2] + *d[5];
+        int32_t tmp5 = *d[2] - *d[5];
+        int32_t tmp3 = *d[3] + *d[4];
+        int32_t tmp4 = *d[3] - *d[4];
+
+        // even part
+        const int32_t tmp10 = tmp0 + tmp3;
+        const int32_t tmp13 = tmp0 - tmp3;
+        const int32_t tmp11 = tmp1 + tmp2;
+        const int32_t tmp12 = tmp1 - tmp2;
+
+        if (rowPass) {
+            *d[0] = (tmp10 + tmp11) << DCTPass1Bits;
+            *d[4] = (tmp10 - tmp11) << DCTPass1Bits;
+        } else {
+            *d[0] = descale(tmp10 + tmp11, evenShift);
+            *d[4] = descale(tmp10 - tmp11, evenShift);
+        }
+
+        int32_t z1 = (tmp12 + tmp13) * Fix_0_541196100;
+        *d[2] = descale(z1 + tmp13 * Fix_0_765366865, oddShift);
+        *d[6] = descale(z1 - tmp12 * Fix_1_847759065, oddShift);
+
+        // odd part
+        z1 = tmp4 + tmp7;
+        int32_t z2 = tmp5 + tmp6;
+        int32_t z3 = tmp4 + tmp6;
+        int32_t z4 = tmp5 + tmp7;
+        const int32_t z5 = (z3 + z4) * Fix_1_175875602;
+
+        tmp4 *= Fix_0_298631336;
+        tmp5 *= Fix_2_053119869;
+        tmp6 *= Fix_3_072711026;
+        tmp7 *= Fix_1_501321110;
+        z1 *= -Fix_0_899976223;
+        z2 *= -Fix_2_562915447;
+        z3 *= -Fix_1_961570560;
+        z4 *= -Fix_0_390180644;
+
+        z3 += z5;
+        z4 += z5;
+
+        *d[7] = descale(tmp4 + z1 + z3, oddShift);
+        *d[5] = descale(tmp5 + z2 + z4, oddShift);
+        *d[3] = descale(tmp6 + z2 + z3, oddShift);
+        *d[1] = descale(tmp7 + z1 + z4, oddShift);
+    }
+}
+
+void Encoder::transformBlockWithIntegerDCT(Block &block) {
+    std::array<int32_t, 64> data{};
+
+    for (unsigned int i = 0; i < 64; i++) {
+        data[i] = block[i] - 128;
+    }
+
+    for (unsigned int y = 0; y < 8; y++) {
+        integerDCTPass(&data[getIndex(0, y, 8)], 1, true);
+    }
+
+    for (unsigned int x = 0; x < 8; x++) {
+        integerDCTPass(&data[getIndex(x, 0, 8)], 8, false);
+    }
+
+    for (unsigned int i = 0; i < 64; i++) {
+        block[i] = data[i];
+    }
+}
+
+template <Encoder::PixelType type>
+void Encoder::quantizeBlock(Block &block) {
+    Block quantized{};
+    const int* table = Tables<type>::quantization();
 
     for (unsigned int i = 0; i < 8; i++) {
         for (unsigned int j = 0; j < 8; j++) {
@@ -133,8 +522,174 @@ void Encoder::quantizeBlock(std::array<int, 64> &block, PixelType type) {
     block = quantized;
 }
 
-void Encoder::zigZagVectorizeBlock(std::array<int, 64> &block) {
-    std::array<int, 64> zigZagVector{};
+// one 1-D pass of the ifast DCT, every value is kept in 16 bits
+static void fastIntegerDCTPass(int16_t* data, unsigned int stride) {
+    using namespace FixedPoint;
+    int16_t* d[8];
+    for (unsigned int k = 0; k < 8; k++) {
+        d[k] = data + k * stride;
+    }
+
+    const int16_t tmp0 = *d[0] + *d[7];
+    const int16_t tmp7 = *d[0] - *d[7];
+    const int16_t tmp1 = *d[1] + *d[6];
+    const int16_t tmp6 = *d[1] - *d[6];
+    const int16_t tmp2 = *d[2] + *d[5];
+    const int16_t tmp5 = *d[2] - *d[5];
+    const int16_t tmp3 = *d[3] + *d[4];
+    const int16_t tmp4 = *d[3] - *d[4];
+
+    // even part
+    const int16_t tmp10 = tmp0 + tmp3;
+    const int16_t tmp13 = tmp0 - tmp3;
+    const int16_t tmp11 = tmp1 + tmp2;
+    const int16_t tmp12 = tmp1 - tmp2;
+
+    *d[0] = tmp10 + tmp11;
+    *d[4] = tmp10 - tmp11;
+
+    const int16_t z1 = fastMultiply(tmp12 + tmp13, FastFix_0_707106781);
+    *d[2] = tmp13 + z1;
+    *d[6] = tmp13 - z1;
+
+    // odd part
+    const int16_t odd10 = tmp4 + tmp5;
+    const int16_t odd11 = tmp5 + tmp6;
+    const int16_t odd12 = tmp6 + tmp7;
+
+    const int16_t z5 = fastMultiply(odd10 - odd12, FastFix_0_382683433);
+    const int16_t z2 = fastMultiply(odd10, FastFix_0_541196100) + z5;
+    const int16_t z4 = fastMultiply(odd12, FastFix_1_306562965) + z5;
+    const int16_t z3 = fastMultiply(odd11, FastFix_0_707106781);
+
+    const int16_t z11 = tmp7 + z3;
+    const int16_t z13 = tmp7 - z3;
+
+    *d[5] = z13 + z2;
+    *d[3] = z13 - z2;
+    *d[1] = z11 + z4;
+    *d[7] = z11 - z4;
+}
+
+// the result keeps the AAN scaling, quantizeTransformedBlock divides it out again
+void Encoder::transformBlockWithFastIntegerDCT(Block &block) {
+    for (unsigned int i = 0; i < 64; i++) {
+        block[i] = (int16_t)(block[i] - 128);
+    }
+
+    for (unsigned int y = 0; y < 8; y++) {
+        fastIntegerDCTPass(&block[getIndex(0, y, 8)], 1);
+    }
+
+    for (unsigned int x = 0; x < 8; x++) {
+        fastIntegerDCTPass(&block[getIndex(x, 0, 8)], 8);
+    }
+}
+
+void Encoder::quantizeBlock(Block &block, PixelType type) {
+    if (type == Luminance)
+        quantizeBlock<Luminance>(block);
+    else
+        quantizeBlock<Chrominance>(block);
+}
+
+// same result as quantizeBlock: for negative values the numerator is lowered by one
+// so that halfway cases still round up like floor(x + 0.5) does
+int Encoder::quantizeWithReciprocal(int value, int divisor, uint32_t reciprocal) {
+    const uint32_t numerator = 2 * (uint32_t)std::abs(value) + divisor - (value < 0 ? 1 : 0);
+    const int magnitude = (int)(((uint64_t)numerator * reciprocal) >> 32);
+
+    return value < 0 ? -magnitude : magnitude;
+}
+
+template <Encoder::PixelType type>
+void Encoder::quantizeBlockWithReciprocals(Block &block) {
+    Simd::quantizeKernel()(block, Tables<type>::divisors());
+}
+
+// quantizes the output of the selected DCT method, which may still carry the AAN scaling
+template <Encoder::PixelType type>
+void Encoder::quantizeTransformedBlock(Block &block) const {
+    if (dctMethod == AANDCT) // already quantized by the transform
+        return;
+
+    if (dctMethod == FastIntegerDCT)
+        Simd::quantizeKernel()(block, Tables<type>::fastIntegerDivisors());
+    else
+        quantizeBlockWithReciprocals<type>(block);
+}
+
+void Encoder::zigZagVectorizeBlock(Block &block) {
+    Block zigZagVector{};
+
+    for (unsigned int i = 0; i < 64; i++) {
+        zigZagVector[i] = block[ZigZagTable[i]];
+    }
+
+    block = zigZagVector;
+}
+
+bool Encoder::isFlatBlock(const Block &block) {
+    for (unsigned int i = 1; i < 64; i++) {
+        if (block[i] != block[0])
+            return false;
+    }
+
+    return true;
+}
+
+// a flat block only has a DC coefficient: 1/8 * 64 * (value - 128), all AC coefficients are zero
+// returns false (and leaves the block untouched) if the block needs a real DCT
+template <Encoder::PixelType type>
+bool Encoder::transformFlatBlock(Block &block, bool quantize) {
+    if (dctMethod == ReferenceDCT || !isFlatBlock(block))
+        return false;
+
+    const int dc = 8 * (block[0] - 128);
+
+    block.fill(0);
+
+    if (quantize)
+        block[0] = quantizeWithReciprocal(dc, Tables<type>::divisors().divisor[0], Tables<type>::divisors().reciprocal[0]);
+    else
+        block[0] = dctMethod == FastIntegerDCT ? 8 * dc : dc; // ifast output is 8 times larger
+    flatBlockCount++;
+
+    return true;
+}
+
+// vectorized kernel of the IntegerDCT or the FastIntegerDCT method
+Simd::BlockKernel Encoder::integerDCTKernel() const {
+    return dctMethod == FastIntegerDCT ? Simd::fastIntegerDCTKernel() : Simd::integerDCTKernel();
+}
+
+template <Encoder::PixelType type>
+void Encoder::transformBlock(Block &block, Simd::BlockKernel integerDCT) {
+    if (transformFlatBlock<type>(block, dctMethod == AANDCT))
+        return;
+
+    switch (dctMethod) {
+        case ReferenceDCT:
+            transformBlockWithDCT(block);
+            break;
+        case AANDCT:
+            transformAndQuantizeBlockWithAANDCT<type>(block);
+            break;
+        case IntegerDCT:
+        case FastIntegerDCT:
+            integerDCT(block);
+            break;
+        default:
+            transformBlockWithSeparableDCT(block);
+            break;
+    }
+}
+
+template <Encoder::PixelType type>
+void Encoder::quantizeAndZigZagBlock(Block &block) const {
+    Block zigZagVector{};
+
+    quantizeTransformedBlock<type>(block);
 
     for (unsigned int i = 0; i < 64; i++) {
         zigZagVector[i] = block[ZigZagTable[i]];
@@ -143,7 +698,60 @@ void Encoder::zigZagVectorizeBlock(std::array<int, 64> &block) {
     block = zigZagVector;
 }
 
-std::vector<int> Encoder::runLengthEncodeBlockAC(const std::array<int, 64> &block) {
+// all per-block stages at once, so the block stays in L1 between them:
+// the level shift happens inside the DCT, quantization and zigzag reordering share a single loop
+template <Encoder::PixelType type>
+void Encoder::transformQuantizeAndZigZagBlock(Block &block, Simd::BlockKernel integerDCT) {
+    // flat block: quantize its DC directly, zigzag order doesn't move position 0
+    if (transformFlatBlock<type>(block, true))
+        return;
+
+    transformBlock<type>(block, integerDCT);
+    quantizeAndZigZagBlock<type>(block);
+}
+
+// integer DCT on groups of BatchGroupSize MCUs: flat blocks are handled on their own,
+// all others are collected per PixelType and handed to the batched kernel together
+void Encoder::transformBlocksBatched(bool quantizeAndZigZag) {
+    const Simd::BatchKernel integerDCTBatch = Simd::integerDCTBatchKernel();
+    const size_t groupSize = BatchGroupSize * blocksPerMCU();
+    Block* luminance[BatchGroupSize * MaxLuminanceBlocks];
+    Block* chrominance[2 * BatchGroupSize];
+
+    for (size_t first = 0; first < blocks.size(); first += groupSize) {
+        const size_t last = std::min(first + groupSize, blocks.size());
+        unsigned int luminanceCount = 0;
+        unsigned int chrominanceCount = 0;
+
+        for (size_t i = first; i < last; i++) {
+            Block& block = blocks[i];
+
+            if (blockType(i) == Luminance) {
+                if (!transformFlatBlock<Luminance>(block, quantizeAndZigZag))
+                    luminance[luminanceCount++] = &block;
+            } else {
+                if (!transformFlatBlock<Chrominance>(block, quantizeAndZigZag))
+                    chrominance[chrominanceCount++] = &block;
+            }
+        }
+
+        integerDCTBatch(luminance, luminanceCount);
+        integerDCTBatch(chrominance, chrominanceCount);
+
+        if (!quantizeAndZigZag)
+            continue;
+
+        for (unsigned int i = 0; i < luminanceCount; i++) {
+            quantizeAndZigZagBlock<Luminance>(*luminance[i]);
+        }
+
+        for (unsigned int i = 0; i < chrominanceCount; i++) {
+            quantizeAndZigZagBlock<Chrominance>(*chrominance[i]);
+        }
+    }
+}
+
+std::vector<int> Encoder::runLengthEncodeBlockAC(const Block &block) {
     std::vector<int> rle;
     int currZeroCount = 0;
 
@@ -170,82 +778,644 @@ std::vector<int> Encoder::runLengthEncodeBlockAC(const std::array<int, 64> &bloc
     return rle;
 }
 
+// the stride is rounded up so that every row starts on an aligned address
+size_t Encoder::Plane::alignedStride(int width, size_t minimumStride) {
+    return (std::max(minimumStride, (size_t)width) + PlaneAlignment - 1) / PlaneAlignment * PlaneAlignment;
+}
+
+void Encoder::Plane::allocate(int width, int height, size_t minimumStride, Arena& arena) {
+    this->width = width;
+    this->height = height;
+    stride = alignedStride(width, minimumStride);
+    data = static_cast<uint8_t*>(arena.allocate(stride * height));
+}
+
+void Encoder::ImageDeleter::operator()(uint8_t* image) const {
+    stbi_image_free(image);
+}
+
 void Encoder::readImagePNG(const std::string &path) {
-    uint8_t* image = stbi_load(path.c_str(), &width, &height, nullptr, 3);
+    int fileChannels = 0;
+    reset();
+
+    // gray and gray + alpha files are decoded to one channel
+    if (stbi_info(path.c_str(), &width, &height, &fileChannels))
+        channels = fileChannels <= 2 ? 1 : 3;
 
-    if (image == nullptr)
+    imageRGB.reset(stbi_load(path.c_str(), &width, &height, nullptr, channels));
+
+    if (imageRGB == nullptr)
         throw std::invalid_argument("Couldn't find file at path: " + path);
+}
+
+// stops at the first colored pixel, so color images are rejected after a few pixels
+bool Encoder::isGrayscale(const uint8_t* rgb, int width, int height, size_t stride) {
+    for (int j = 0; j < height; j++) {
+        const uint8_t* row = rgb + j * stride;
+
+        for (int i = 0; i < width; i++) {
+            const uint8_t* pixel = row + 3 * i;
 
-    for (unsigned int i = 0; i < 3 * width * height; i += 3) {
-        imageRGB.emplace_back(image[i], image[i+1], image[i+2]);
+            if (pixel[0] != pixel[1] || pixel[0] != pixel[2])
+                return false;
+        }
     }
 
-    stbi_image_free(image);
+    return true;
+}
+
+void Encoder::setImageSize(int width, int height, int channels) {
+    reset();
+    this->width = width;
+    this->height = height;
+    this->channels = channels == 1 ? 1 : 3;
+}
+
+// the first stage of every encode picks the components and the sampling, so options set after reading still apply;
+// rgb holds the whole image (rows stride bytes apart) or is null if the pixels aren't known yet
+void Encoder::chooseComponentsAndSampling(const uint8_t* rgb, size_t stride) {
+    chooseComponents(rgb, stride);
+    chooseSampling(rgb, stride);
+}
+
+void Encoder::chooseComponents(const uint8_t* rgb, size_t stride) {
+    components = channels == 1 || (rgb != nullptr && isGrayscale(rgb, width, height, stride)) ? 1 : 3;
+}
+
+// screenshots, diagrams and other synthetic images consist of long runs of a small palette of colors,
+// and their sharp color edges are exactly where chroma subsampling is visible; photographs (even foggy
+// or banded ones, which repeat pixels too) use thousands of colors. Looks at every height / 64-th row, which
+// is every row up to a height of 127 and 64 to 127 rows above. The colors go into an open-addressed set of at
+// most 2 * 4096 slots (32 KB), the 4096th color settles it.
+bool Encoder::isPhotographic(const uint8_t* rgb, int width, int height, size_t stride, Arena& scratch) {
+    const int rowStep = std::max(1, height / 64);
+    const size_t PhotographicColors = 4096;
+    const size_t sampledPixels = (size_t)((height + rowStep - 1) / rowStep) * width;
+    const uint32_t Empty = 0xFFFFFFFF; // no 24-bit color
+    int slotBits = 1;
+
+    while ((size_t)1 << slotBits < 2 * std::min(sampledPixels, PhotographicColors))
+        slotBits++;
+
+    const uint32_t slotMask = (1u << slotBits) - 1;
+    scratch.reset(((size_t)1 << slotBits) * sizeof(uint32_t));
+    uint32_t* seen = static_cast<uint32_t*>(scratch.allocate(((size_t)1 << slotBits) * sizeof(uint32_t)));
+    std::fill(seen, seen + slotMask + 1, Empty);
+    size_t pixels = 0;
+    size_t repeats = 0;
+    size_t colors = 0;
+
+    for (int j = 0; j < height; j += rowStep) {
+        const uint8_t* row = rgb + j * stride;
+
+        for (int i = 0; i < width; i++) {
+            const uint8_t* pixel = row + 3 * i;
+            const uint32_t color = pixel[0] << 16 | pixel[1] << 8 | pixel[2];
+            uint32_t slot = color * 2654435761u >> (32 - slotBits); // Fibonacci hashing, linear probing
+
+            while (seen[slot] != color && seen[slot] != Empty)
+                slot = (slot + 1) & slotMask;
+
+            if (seen[slot] == Empty) {
+                seen[slot] = color;
+
+                if (++colors == PhotographicColors)
+                    return true;
+            }
+
+            if (i > 0)
+                repeats += pixel[0] == pixel[-3] && pixel[1] == pixel[-2] && pixel[2] == pixel[-1];
+        }
+
+        pixels += width;
+    }
+
+    return repeats < pixels / 2;
+}
+
+// luminance sampling factors of each mode, chroma is always sampled once per MCU
+void Encoder::chooseSampling(const uint8_t* rgb, size_t stride) {
+    ChromaSubsampling subsampling = components == 1 ? Subsampling444 : chromaSubsampling; // a single component has 8x8 MCUs
+
+    // rows that are passed in later (setImageSize) can't be looked at in advance, they are taken for a photograph
+    if (subsampling == AutomaticSubsampling)
+        subsampling = rgb == nullptr || isPhotographic(rgb, width, height, stride, arena) ? Subsampling420 : Subsampling444;
+
+    switch (subsampling) {
+        case Subsampling422:
+            horizontalSampling = 2;
+            verticalSampling = 1;
+            break;
+        case Subsampling420:
+            horizontalSampling = 2;
+            verticalSampling = 2;
+            break;
+        case Subsampling440:
+            horizontalSampling = 1;
+            verticalSampling = 2;
+            break;
+        case Subsampling411:
+            horizontalSampling = 4;
+            verticalSampling = 1;
+            break;
+        default:
+            horizontalSampling = 1;
+            verticalSampling = 1;
+    }
+}
+
+unsigned int Encoder::luminanceBlocksPerMCU() const {
+    return horizontalSampling * verticalSampling;
+}
+
+unsigned int Encoder::blocksPerMCU() const {
+    return luminanceBlocksPerMCU() + components - 1;
+}
+
+// blocks of the whole image, createPaddedImage must have run
+size_t Encoder::imageBlockCount() const {
+    return (size_t)(paddedWidth / 8) * (paddedHeight / 8) / luminanceBlocksPerMCU() * blocksPerMCU();
+}
+
+// every buffer of an encode comes from the arena, which is sized here in one go for planes of planeRows rows
+// and blockCount blocks; earlier planes and blocks are dropped first, their memory is handed out again
+void Encoder::resetWorkingMemory(int planeRows, size_t blockCount) {
+    blocks = BlockVector(ArenaAllocator<Block>(&arena));
+    imageYCbCr = std::array<Plane, 3>();
+
+    const size_t planeBytes = Arena::align(Plane::alignedStride(width, rowStride) * planeRows);
+    arena.reset(components * planeBytes + Arena::align(blockCount * sizeof(Block)));
+    blocks.reserve(blockCount);
+}
+
+// the options stay, the arena keeps its memory for the next image
+void Encoder::reset() {
+    imageRGB.reset();
+    stream.reset();
+    blocks = BlockVector(ArenaAllocator<Block>(&arena));
+    imageYCbCr = std::array<Plane, 3>();
+    arena.reset(arena.capacity());
+
+    width = height = 0;
+    paddedWidth = paddedHeight = 0;
+    flatBlockCount = 0;
+}
+
+void Encoder::releaseWorkingMemory() {
+    blocks = BlockVector(ArenaAllocator<Block>(&arena));
+    imageYCbCr = std::array<Plane, 3>();
+    arena.release();
+}
+
+size_t Encoder::workingMemoryHighWaterMark() const {
+    return arena.highWaterMark();
+}
+
+Encoder::PixelType Encoder::blockType(size_t index) const {
+    return index % blocksPerMCU() < luminanceBlocksPerMCU() ? Luminance : Chrominance;
+}
+
+// converts rows image rows of packed pixels (channels samples each, stride bytes apart) into the first rows of the planes
+void Encoder::convertRows(const uint8_t* rgb, size_t stride, const std::array<Plane, 3>& planes, int rows) const {
+    const Plane& y = planes[0];
+    const Plane& cb = planes[1];
+    const Plane& cr = planes[2];
+
+    // the luminance coefficients sum to 1, so Y of a gray pixel is its value (in both conversions)
+    if (components == 1) {
+        for (int j = 0; j < rows; j++) {
+            const uint8_t* row = rgb + j * stride;
+
+            if (channels == 1) {
+                std::copy(row, row + width, y.row(j));
+            } else {
+                for (int i = 0; i < width; i++) {
+                    y.row(j)[i] = row[3 * i];
+                }
+            }
+        }
+    } else if (colorConversion == ReferenceColorConversion) {
+        for (int j = 0; j < rows; j++) {
+            for (int i = 0; i < width; i++) {
+                const uint8_t* pixel = rgb + j * stride + 3 * i;
+                const YCbCr ycbcr = RGBToYCbCr(RGB(pixel[0], pixel[1], pixel[2]));
+
+                y.row(j)[i] = ycbcr.y;
+                cb.row(j)[i] = ycbcr.cb;
+                cr.row(j)[i] = ycbcr.cr;
+            }
+        }
+    } else {
+        const Simd::ColorKernel kernel = Simd::colorKernel();
+
+        for (int j = 0; j < rows; j++) {
+            kernel(rgb + j * stride, y.row(j), cb.row(j), cr.row(j), width);
+        }
+    }
 }
 
 void Encoder::convertColorspace() {
-    for (const RGB& rgb : imageRGB) {
-        imageYCbCr.emplace_back(RGBToYCbCr(rgb));
+    chooseComponentsAndSampling(imageRGB.get(), channels * (size_t)width);
+
+    // the blocks that generateBlocks cuts from these planes are accounted for as well
+    createPaddedImage();
+    resetWorkingMemory(height, imageBlockCount());
+
+    for (int c = 0; c < components; c++) {
+        imageYCbCr[c].allocate(width, height, rowStride, arena);
     }
+
+    convertRows(imageRGB.get(), channels * (size_t)width, imageYCbCr, height);
+    imageRGB.reset();
 }
 
+// the padding is virtual: loadEdgeBlock repeats the last column and row while the edge blocks are extracted
 void Encoder::createPaddedImage() {
-    paddedWidth = width % 8 == 0 ? width : width + (8 - (width % 8));
-    paddedHeight = height % 8 == 0 ? height : height + (8 - (height % 8));
+    const int mcuWidth = 8 * horizontalSampling;
+    const int mcuHeight = 8 * verticalSampling;
+
+    paddedWidth = width % mcuWidth == 0 ? width : width + (mcuWidth - (width % mcuWidth));
+    paddedHeight = height % mcuHeight == 0 ? height : height + (mcuHeight - (height % mcuHeight));
+}
+
+// eight contiguous 8-byte rows
+void Encoder::loadBlock(const Plane& plane, int x, int y, Block& block) {
+    for (unsigned int j = 0; j < 8; j++) {
+        const uint8_t* row = plane.row(y + j) + x;
 
-    for (int j = 0; j < paddedHeight; j++) {
-        for (int i = 0; i < paddedWidth; i++) {
-            YCbCr pixel = imageYCbCr[getIndex(min(i, width - 1), min(j, height - 1), width)];
-            paddedYCbCr.push_back(pixel);
+        for (unsigned int i = 0; i < 8; i++) {
+            block[getIndex(i, j, 8)] = row[i];
         }
     }
 }
 
-void Encoder::generateBlocks() {
-    for (int mcuY = 0; mcuY < paddedHeight; mcuY += 8) {
-        for (int mcuX = 0; mcuX < paddedWidth; mcuX += 8) {
-            Block block;
-
-            for (int y = mcuY; y < mcuY + 8; y++) {
-                for (int x = mcuX; x < mcuX + 8; x++) {
-                    block.y[getIndex(x - mcuX, y - mcuY, 8)] = paddedYCbCr[getIndex(x, y, paddedWidth)].y;
-                    block.cb[getIndex(x - mcuX, y - mcuY, 8)] = paddedYCbCr[getIndex(x, y, paddedWidth)].cb;
-                    block.cr[getIndex(x - mcuX, y - mcuY, 8)] = paddedYCbCr[getIndex(x, y, paddedWidth)].cr;
+// block reaching past the right or bottom edge of the plane, the missing samples repeat the last column and row
+void Encoder::loadEdgeBlock(const Plane& plane, int x, int y, Block& block) {
+    for (int j = 0; j < 8; j++) {
+        const uint8_t* row = plane.row(min(y + j, plane.height - 1));
+
+        for (int i = 0; i < 8; i++) {
+            block[getIndex(i, j, 8)] = row[min(x + i, plane.width - 1)];
+        }
+    }
+}
+
+// blocks that lie completely inside the plane take the unclamped path
+void Encoder::extractBlock(const Plane& plane, int x, int y, Block& block) {
+    if (x + 8 <= plane.width && y + 8 <= plane.height)
+        loadBlock(plane, x, y, block);
+    else
+        loadEdgeBlock(plane, x, y, block);
+}
+
+// h x v box filter over an 8h x 8v area, one kernel per sampling mode so that the compiler unrolls the sums;
+// the rounding bias alternates between h * v / 2 - 1 and h * v / 2 (0/1 for two samples, 1/2 for four, as in libjpeg)
+// so that the averages don't drift upwards
+template <int h, int v>
+void Encoder::loadDownsampledBlock(const Plane& plane, int x, int y, Block& block) {
+    const unsigned int bias = h * v / 2 - 1;
+
+    for (int j = 0; j < 8; j++) {
+        const uint8_t* rows[v];
+
+        for (int k = 0; k < v; k++) {
+            rows[k] = plane.row(y + v * j + k) + x;
+        }
+
+        for (int i = 0; i < 8; i++) {
+            unsigned int sum = bias + (i & 1);
+
+            for (int k = 0; k < v; k++) {
+                for (int l = 0; l < h; l++) {
+                    sum += rows[k][h * i + l];
                 }
             }
 
-            blocks.push_back(block);
+            block[getIndex(i, j, 8)] = sum / (h * v);
         }
     }
 }
 
+template <int h, int v>
+void Encoder::loadDownsampledEdgeBlock(const Plane& plane, int x, int y, Block& block) {
+    const unsigned int bias = h * v / 2 - 1;
+
+    for (int j = 0; j < 8; j++) {
+        const uint8_t* rows[v];
+
+        for (int k = 0; k < v; k++) {
+            rows[k] = plane.row(min(y + v * j + k, plane.height - 1));
+        }
+
+        for (int i = 0; i < 8; i++) {
+            unsigned int sum = bias + (i & 1);
+
+            for (int k = 0; k < v; k++) {
+                for (int l = 0; l < h; l++) {
+                    sum += rows[k][min(x + h * i + l, plane.width - 1)];
+                }
+            }
+
+            block[getIndex(i, j, 8)] = sum / (h * v);
+        }
+    }
+}
+
+template <int h, int v>
+void Encoder::extractDownsampledBlock(const Plane& plane, int x, int y, Block& block) {
+    if (x + 8 * h <= plane.width && y + 8 * v <= plane.height)
+        loadDownsampledBlock<h, v>(plane, x, y, block);
+    else
+        loadDownsampledEdgeBlock<h, v>(plane, x, y, block);
+}
+
+Encoder::BlockLoader Encoder::chromaBlockLoader() const {
+    if (horizontalSampling == 2 && verticalSampling == 1)
+        return extractDownsampledBlock<2, 1>;
+
+    if (horizontalSampling == 2 && verticalSampling == 2)
+        return extractDownsampledBlock<2, 2>;
+
+    if (horizontalSampling == 1 && verticalSampling == 2)
+        return extractDownsampledBlock<1, 2>;
+
+    if (horizontalSampling == 4 && verticalSampling == 1)
+        return extractDownsampledBlock<4, 1>;
+
+    return extractBlock;
+}
+
+// appends the MCUs whose top samples are row top of the planes
+void Encoder::generateMCURow(const std::array<Plane, 3>& planes, int top) {
+    const BlockLoader loadChromaBlock = chromaBlockLoader();
+
+    for (int mcuX = 0; mcuX < paddedWidth; mcuX += 8 * horizontalSampling) {
+        for (int j = 0; j < verticalSampling; j++) {
+            for (int i = 0; i < horizontalSampling; i++) {
+                blocks.emplace_back();
+                extractBlock(planes[0], mcuX + 8 * i, top + 8 * j, blocks.back());
+            }
+        }
+
+        for (int c = 1; c < components; c++) {
+            blocks.emplace_back();
+            loadChromaBlock(planes[c], mcuX, top, blocks.back());
+        }
+    }
+}
+
+// cuts rows rows of packed pixels into MCU-high strips, converts each into the strip planes and appends its MCU row,
+// then hands the strip's row count to stripDone
+template <typename StripDone>
+void Encoder::generateStrips(const uint8_t* rgb, size_t stride, int rows, std::array<Plane, 3>& strip, StripDone stripDone) {
+    const int mcuHeight = 8 * verticalSampling;
+
+    for (int first = 0; first < rows; first += mcuHeight) {
+        const int count = min(mcuHeight, rows - first);
+
+        // the last strip is shorter, its planes are too so that loadEdgeBlock repeats its last row
+        for (int c = 0; c < components; c++) {
+            strip[c].height = count;
+        }
+
+        convertRows(rgb + first * stride, stride, strip, count);
+        generateMCURow(strip, 0);
+        stripDone(count);
+    }
+}
+
+void Encoder::generateBlocks() {
+    blocks.reserve(imageBlockCount());
+
+    for (int mcuY = 0; mcuY < paddedHeight; mcuY += 8 * verticalSampling) {
+        generateMCURow(imageYCbCr, mcuY);
+    }
+}
+
+// convertColorspace, createPaddedImage and generateBlocks in one pass: each MCU-high strip of RGB is converted
+// into a small strip of planes and cut into blocks right away, so the full-size planes are never allocated
+void Encoder::convertColorspaceAndGenerateBlocks() {
+    chooseComponentsAndSampling(imageRGB.get(), channels * (size_t)width);
+
+    const int mcuHeight = 8 * verticalSampling;
+    std::array<Plane, 3> strip;
+
+    createPaddedImage();
+    resetWorkingMemory(mcuHeight, imageBlockCount());
+
+    for (int c = 0; c < components; c++) {
+        strip[c].allocate(width, mcuHeight, rowStride, arena);
+    }
+
+    generateStrips(imageRGB.get(), channels * (size_t)width, height, strip, [](int) {});
+
+    imageRGB.reset();
+}
+
 void Encoder::transformBlocksWithDCT() {
-    for (Block& block : blocks) {
-        transformBlockWithDCT(block.y);
-        transformBlockWithDCT(block.cb);
-        transformBlockWithDCT(block.cr);
+    const Simd::BlockKernel integerDCT = integerDCTKernel();
+    flatBlockCount = 0;
+
+    if (batchedDCT && dctMethod == IntegerDCT) {
+        transformBlocksBatched(false);
+    } else {
+        for (size_t i = 0; i < blocks.size(); i++) {
+            if (blockType(i) == Luminance)
+                transformBlock<Luminance>(blocks[i], integerDCT);
+            else
+                transformBlock<Chrominance>(blocks[i], integerDCT);
+        }
     }
 
-    std::cout << "Discrete Cosine Transform ran on " << blocks.size() << " blocks." << std::endl;
+    if (verbose)
+        std::cout << "Discrete Cosine Transform ran on " << blocks.size() << " blocks"
+                  << " (" << flatBlockCount << " flat blocks skipped)." << std::endl;
 }
 
 void Encoder::quantizeBlocks() {
-    for (Block& block : blocks) {
-        quantizeBlock(block.y, Luminance);
-        quantizeBlock(block.cb, Chrominance);
-        quantizeBlock(block.cr, Chrominance);
+    // same result as quantizeBlock, without the double divisions
+    for (size_t i = 0; i < blocks.size(); i++) {
+        if (blockType(i) == Luminance)
+            quantizeTransformedBlock<Luminance>(blocks[i]);
+        else
+            quantizeTransformedBlock<Chrominance>(blocks[i]);
     }
 }
 
 void Encoder::zigZagVectorizeBlocks() {
     for (Block& block : blocks) {
-        zigZagVectorizeBlock(block.y);
-        zigZagVectorizeBlock(block.cb);
-        zigZagVectorizeBlock(block.cr);
+        zigZagVectorizeBlock(block);
+    }
+}
+
+// blocks must start at an MCU boundary, flatBlockCount keeps counting
+void Encoder::transformQuantizeAndZigZagMCUs() {
+    if (batchedDCT && dctMethod == IntegerDCT) {
+        transformBlocksBatched(true);
+    } else {
+        const Simd::BlockKernel integerDCT = integerDCTKernel();
+
+        for (size_t i = 0; i < blocks.size(); i++) {
+            if (blockType(i) == Luminance)
+                transformQuantizeAndZigZagBlock<Luminance>(blocks[i], integerDCT);
+            else
+                transformQuantizeAndZigZagBlock<Chrominance>(blocks[i], integerDCT);
+        }
+    }
+}
+
+// replaces transformBlocksWithDCT + quantizeBlocks + zigZagVectorizeBlocks with a single pass over all blocks
+void Encoder::transformQuantizeAndZigZagBlocks() {
+    flatBlockCount = 0;
+    transformQuantizeAndZigZagMCUs();
+
+    if (verbose)
+        std::cout << "Discrete Cosine Transform ran on " << blocks.size() << " blocks"
+                  << " (" << flatBlockCount << " flat blocks skipped)." << std::endl;
+}
+
+// state of beginStream .. endStream
+struct Encoder::Stream {
+    explicit Stream(const std::string& path) : file(path, std::ios::out | std::ios::binary), writer(file) {}
+
+    std::ofstream file;
+    TooJpeg::StreamWriter writer;
+    std::array<Plane, 3> strip; // one MCU row of planes
+    int rows = 0; // image rows encoded so far
+    size_t blockCount = 0;
+};
+
+Encoder::Encoder() = default;
+
+Encoder::~Encoder() = default;
+
+// after readImagePNG the decoded image is looked at in advance, rows passed in later (setImageSize) can't be
+bool Encoder::beginStream(const std::string& path) {
+    return beginStream(path, imageRGB.get(), channels * (size_t)width);
+}
+
+// the SOF0 header stores width and height in 16 bits
+static bool fitsJpegHeader(int width, int height) {
+    if (width <= Encoder::MaxImageSize && height <= Encoder::MaxImageSize)
+        return true;
+
+    std::cout << "Image is larger than " << Encoder::MaxImageSize << " pixels, use Tiled::encodeRawImage!" << std::endl;
+    return false;
+}
+
+// the SOF0 sampling factors of Y, Cb and Cr: chroma is always sampled once per MCU
+static std::array<TooJpeg::SamplingFactors, 3> samplingFactors(int horizontal, int vertical) {
+    const std::array<TooJpeg::SamplingFactors, 3> sampling = {{ { (uint8_t)horizontal, (uint8_t)vertical }, { 1, 1 }, { 1, 1 } }};
+    return sampling;
+}
+
+bool Encoder::beginStream(const std::string& path, const uint8_t* rgb, size_t stride) {
+    if (!fitsJpegHeader(width, height))
+        return false;
+
+    chooseComponentsAndSampling(rgb, stride);
+    stream.reset(new Stream(path));
+
+    if (!stream->file) {
+        std::cout << "Failed to open file to write!" << std::endl;
+        stream.reset();
+        return false;
+    }
+
+    const std::array<TooJpeg::SamplingFactors, 3> sampling = samplingFactors(horizontalSampling, verticalSampling);
+
+    if (!stream->writer.writeHeaders(width, height, components, sampling.data())) {
+        std::cout << "Image format is not supported!" << std::endl;
+        stream.reset();
+        return false;
+    }
+
+    createPaddedImage();
+    resetWorkingMemory(8 * verticalSampling, (size_t)(paddedWidth / 8) / horizontalSampling * blocksPerMCU());
+    flatBlockCount = 0;
+
+    for (int c = 0; c < components; c++) {
+        stream->strip[c].allocate(width, 8 * verticalSampling, rowStride, arena);
+    }
+
+    return true;
+}
+
+// one MCU row at a time: blocks never holds more than one row of MCUs and the strip planes are MCU-high,
+// so all memory besides the caller's pixels grows with the width only
+void Encoder::streamRows(const uint8_t* pixels, size_t stride, int rows) {
+    generateStrips(pixels, stride, min(rows, height - stream->rows), stream->strip, [this](int count) {
+        transformQuantizeAndZigZagMCUs();
+        stream->writer.writeBlocks(blocks.data(), blocks.size());
+
+        stream->blockCount += blocks.size();
+        stream->rows += count;
+        blocks.clear();
+    });
+}
+
+void Encoder::endStream() {
+    stream->writer.finish();
+
+    if (verbose)
+        std::cout << "Discrete Cosine Transform ran on " << stream->blockCount << " blocks"
+                  << " (" << flatBlockCount << " flat blocks skipped)." << std::endl;
+
+    stream.reset();
+    blocks.clear();
+}
+
+void Encoder::encodeStreaming(const std::string& path) {
+    if (beginStream(path)) {
+        streamRows(imageRGB.get(), channels * (size_t)width, height);
+        endStream();
     }
+
+    imageRGB.reset();
+}
+
+bool Encoder::encode(const uint8_t* pixels, int width, int height, size_t stride, PixelFormat format, const std::string& path) {
+    const int channels = format == Gray8 ? 1 : 3;
+
+    const size_t rowBytes = (size_t)std::max(width, 0) * channels;
+
+    if (stride == 0)
+        stride = rowBytes;
+
+    if (pixels == nullptr || width <= 0 || height <= 0 || width > MaxImageSize || height > MaxImageSize || stride < rowBytes)
+        return false;
+
+    reset();
+    this->width = width;
+    this->height = height;
+    this->channels = channels;
+
+    if (!beginStream(path, pixels, stride))
+        return false;
+
+    streamRows(pixels, stride, height);
+    endStream();
+
+    return true;
+}
+
+bool Encoder::encode(const std::vector<uint8_t>& pixels, int width, int height, size_t stride, PixelFormat format,
+                     const std::string& path) {
+    const size_t rowBytes = (size_t)std::max(width, 0) * (format == Gray8 ? 1 : 3);
+
+    const size_t rowStride = stride == 0 ? rowBytes : stride;
+
+    // the pointer overload checks everything else
+    if (height > 0 && pixels.size() < rowStride * (height - 1) + rowBytes)
+        return false;
+
+    return encode(pixels.data(), width, height, stride, format, path);
 }
 
 void Encoder::writeJPEG(const std::string &path) const {
+    if (!fitsJpegHeader(width, height))
+        return;
+
     std::ofstream wf(path, std::ios::out | std::ios::binary);
 
     if (!wf) {
@@ -253,7 +1423,9 @@ void Encoder::writeJPEG(const std::string &path) const {
         return;
     }
 
-    TooJpeg::writeJpeg(wf, blocks, width, height);
+    const std::array<TooJpeg::SamplingFactors, 3> sampling = samplingFactors(horizontalSampling, verticalSampling);
+
+    TooJpeg::writeJpeg(wf, blocks, width, height, components, sampling.data());
 
     wf.close();
 }
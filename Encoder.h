@@ -1,12 +1,20 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <vector>
 #include <array>
+#include <memory>
 #include <string>
 
+#include "Arena.h"
+#include "Simd.h"
+
 class Encoder {
 public:
+    Encoder();
+    ~Encoder();
+
     struct RGB {
         uint8_t r;
         uint8_t g;
@@ -31,28 +39,84 @@ public:
         }
     };
 
-    struct Block {
-        std::array<int, 64> y{};
-        std::array<int, 64> cb{};
-        std::array<int, 64> cr{};
+    // 8x8 samples or coefficients of one component, every DCT output (even the unquantized ifast one) fits into 16 bits
+    typedef std::array<int16_t, 64> Block;
+    typedef std::vector<Block, ArenaAllocator<Block>> BlockVector;
+
+    // releases a pixel buffer returned by stb_image
+    struct ImageDeleter {
+        void operator()(uint8_t* image) const;
+    };
+
+    // one image channel: rows of width samples that start every stride bytes on PlaneAlignment boundaries,
+    // the samples belong to the Encoder's arena
+    struct Plane {
+        int width = 0;
+        int height = 0;
+        size_t stride = 0;
+        uint8_t* data = nullptr;
+
+        static size_t alignedStride(int width, size_t minimumStride);
+        void allocate(int width, int height, size_t minimumStride, Arena& arena);
+        uint8_t* row(int y) const { return data + (size_t)y * stride; }
     };
 
     enum PixelType { Luminance, Chrominance };
+    enum DCTMethod { ReferenceDCT, SeparableDCT, AANDCT, IntegerDCT, FastIntegerDCT };
+    enum DCTPrecision { DoublePrecision, FloatPrecision, Fixed32Precision, Fixed16Precision };
+    enum ColorConversion { ReferenceColorConversion, FixedPointColorConversion };
+    enum PixelFormat { Gray8, RGB24 }; // packed 8-bit samples of caller-owned pixels
+    // AutomaticSubsampling picks 4:2:0 for photographic input and 4:4:4 otherwise
+    enum ChromaSubsampling { AutomaticSubsampling, Subsampling444, Subsampling422, Subsampling420, Subsampling440, Subsampling411 };
 
     const static int LuminanceQuantizationTable[64];
     const static int ChrominanceQuantizationTable[64];
     const static int ZigZagTable[64];
+    const static double ColorConversionMatrix[9];
+    const static std::array<int16_t, 9> ColorConversionCoefficients;
+    const static std::array<int32_t, 9 * 256> ColorConversionTable;
+    const static std::array<double, 64> CosineTable;
+    const static std::array<float, 64> AANLuminanceScaleTable;
+    const static std::array<float, 64> AANChrominanceScaleTable;
+    const static Simd::Divisors LuminanceDivisors;
+    const static Simd::Divisors ChrominanceDivisors;
+    const static Simd::Divisors FastIntegerLuminanceDivisors;
+    const static Simd::Divisors FastIntegerChrominanceDivisors;
+
+    const static size_t BatchGroupSize = 16; // MCUs per call of the batched DCT
+    const static unsigned int MaxLuminanceBlocks = 4; // per MCU
+    const static size_t PlaneAlignment = 32; // one AVX2 register
+    const static int MaxImageSize = 65535; // largest width and height a JPEG header can store, see Tiled for larger images
 
-    int width;
-    int height;
-    int paddedWidth;
-    int paddedHeight;
-    std::array<double, 64> cosineTable{};
+    // extracts the block whose top left sample (at full resolution) is x, y
+    typedef void (*BlockLoader)(const Plane& plane, int x, int y, Block& block);
 
-    std::vector<RGB> imageRGB;
-    std::vector<YCbCr> imageYCbCr;
-    std::vector<YCbCr> paddedYCbCr;
-    std::vector<Block> blocks;
+    // tables belonging to one PixelType, so per-block kernels pick them at compile time
+    template <PixelType type> struct Tables;
+
+    int width = 0;
+    int height = 0;
+    int paddedWidth = 0;
+    int paddedHeight = 0;
+    ColorConversion colorConversion = FixedPointColorConversion;
+    ChromaSubsampling chromaSubsampling = AutomaticSubsampling;
+    int components = 3; // 3: Y, Cb and Cr; 1: grayscale, Y only
+    int horizontalSampling = 1; // luminance blocks per MCU across and down, each chroma component has one block per MCU
+    int verticalSampling = 1;
+    DCTMethod dctMethod = SeparableDCT;
+    bool batchedDCT = false; // transform several blocks per SIMD instruction (IntegerDCT only)
+    bool verbose = true;
+    size_t rowStride = 0; // minimum row stride of the planes, 0 for the smallest aligned one
+    unsigned long flatBlockCount = 0; // channel blocks that skipped the DCT because all 64 samples were equal
+
+    std::unique_ptr<uint8_t, ImageDeleter> imageRGB; // packed RGB24 from the decoder, released by convertColorspace
+    int channels = 3; // samples per pixel in imageRGB, 1 if the file itself is grayscale
+    Arena arena; // planes, strips and blocks, sized up front by resetWorkingMemory
+    std::array<Plane, 3> imageYCbCr; // Y, Cb and Cr planes (only Y for grayscale)
+    BlockVector blocks = BlockVector(ArenaAllocator<Block>(&arena)); // in scan order: the luminance blocks of an MCU row by row, then its Cb and Cr block
+
+    struct Stream;
+    std::unique_ptr<Stream> stream; // output of beginStream .. endStream
 
     static int round(double num);
     static int clamp(int num, int low, int high);
@@ -60,23 +124,106 @@ public:
     static unsigned int getIndex(unsigned int x, unsigned int y, unsigned int width);
 
     static YCbCr RGBToYCbCr(const RGB& in);
-    void generateCosineTable();
+    static std::array<int16_t, 9> generateColorConversionCoefficients();
+    static std::array<int32_t, 9 * 256> generateColorConversionTable();
+    static YCbCr RGBToYCbCrWithTable(const RGB& in);
+    static std::array<double, 64> generateCosineTable();
+    static double aanScaleFactor(unsigned int k); // s(0) = 1, s(k) = sqrt(2) * cos(k*PI/16)
+    static std::array<float, 64> generateAANScaleTable(const int* quantizationTable);
+    static Simd::Divisors generateDivisors(const int* divisorTable);
+    static std::array<int, 64> generateFastIntegerDivisorTable(const int* quantizationTable);
     static double C(unsigned int i);
-    int calcDCTCoefficient(unsigned int x, unsigned int y, const std::array<int, 64>& block);
-    void transformBlockWithDCT(std::array<int, 64>& block);
-    static void quantizeBlock(std::array<int, 64>& block, PixelType type);
-    static void zigZagVectorizeBlock(std::array<int, 64>& block);
-    static std::vector<int> runLengthEncodeBlockAC(const std::array<int, 64>& block); // unused (replicated in Writer)
+    static int calcDCTCoefficient(unsigned int x, unsigned int y, const Block& block);
+    static void transformBlockWithDCT(Block& block);
+    static void transformBlockWithSeparableDCT(Block& block);
+    static void transformBlockWithAANDCT(Block& block, const std::array<float, 64>& scale);
+    template <PixelType type> static void transformAndQuantizeBlockWithAANDCT(Block& block);
+    static void transformBlockWithIntegerDCT(Block& block);
+    static void transformBlockWithFastIntegerDCT(Block& block);
+    template <PixelType type> static void quantizeBlock(Block& block);
+    static void quantizeBlock(Block& block, PixelType type);
+    static int quantizeWithReciprocal(int value, int divisor, uint32_t reciprocal);
+    template <PixelType type> static void quantizeBlockWithReciprocals(Block& block);
+    template <PixelType type> void quantizeTransformedBlock(Block& block) const;
+    static void zigZagVectorizeBlock(Block& block);
+    static bool isPhotographic(const uint8_t* rgb, int width, int height, size_t stride, Arena& scratch);
+    static bool isGrayscale(const uint8_t* rgb, int width, int height, size_t stride);
+    void chooseComponentsAndSampling(const uint8_t* rgb, size_t stride);
+    void chooseComponents(const uint8_t* rgb, size_t stride);
+    void chooseSampling(const uint8_t* rgb, size_t stride);
+    unsigned int luminanceBlocksPerMCU() const;
+    unsigned int blocksPerMCU() const;
+    size_t imageBlockCount() const;
+    void resetWorkingMemory(int planeRows, size_t blockCount);
+    PixelType blockType(size_t index) const;
+    static void loadBlock(const Plane& plane, int x, int y, Block& block);
+    static void loadEdgeBlock(const Plane& plane, int x, int y, Block& block);
+    static void extractBlock(const Plane& plane, int x, int y, Block& block);
+    template <int h, int v> static void loadDownsampledBlock(const Plane& plane, int x, int y, Block& block);
+    template <int h, int v> static void loadDownsampledEdgeBlock(const Plane& plane, int x, int y, Block& block);
+    template <int h, int v> static void extractDownsampledBlock(const Plane& plane, int x, int y, Block& block);
+    BlockLoader chromaBlockLoader() const;
+    void convertRows(const uint8_t* rgb, size_t stride, const std::array<Plane, 3>& planes, int rows) const;
+    void generateMCURow(const std::array<Plane, 3>& planes, int top);
+    template <typename StripDone>
+    void generateStrips(const uint8_t* rgb, size_t stride, int rows, std::array<Plane, 3>& strip, StripDone stripDone);
+    static bool isFlatBlock(const Block& block);
+    template <PixelType type> bool transformFlatBlock(Block& block, bool quantize);
+    Simd::BlockKernel integerDCTKernel() const;
+    template <PixelType type> void transformBlock(Block& block, Simd::BlockKernel integerDCT);
+    template <PixelType type> void quantizeAndZigZagBlock(Block& block) const;
+    template <PixelType type> void transformQuantizeAndZigZagBlock(Block& block, Simd::BlockKernel integerDCT);
+    void transformBlocksBatched(bool quantizeAndZigZag);
+    void transformQuantizeAndZigZagMCUs();
+    bool beginStream(const std::string& path, const uint8_t* rgb, size_t stride);
+    static std::vector<int> runLengthEncodeBlockAC(const Block& block); // unused (replicated in Writer)
 
 public:
-    Encoder();
+    // options take effect when an encode starts (convertColorspace*, beginStream or encode), before or after readImagePNG
+    void setColorConversion(ColorConversion conversion);
+    void setChromaSubsampling(ChromaSubsampling subsampling);
+    void setDCTMethod(DCTMethod method);
+    void setDCTPrecision(DCTPrecision precision);
+    void setBatchedDCT(bool batched);
+    void setVerbose(bool enabled);
+    void setRowStride(size_t stride);
 
     void readImagePNG(const std::string& path);
+    // instead of readImagePNG: an image of packed 8-bit pixels (channels 1 for gray, 3 for RGB) that is
+    // passed to streamRows piece by piece; grayscale detection and automatic subsampling can't see it in advance
+    void setImageSize(int width, int height, int channels);
     void convertColorspace();
     void createPaddedImage();
     void generateBlocks();
+    void convertColorspaceAndGenerateBlocks();
     void transformBlocksWithDCT();
     void quantizeBlocks();
     void zigZagVectorizeBlocks();
+    void transformQuantizeAndZigZagBlocks();
     void writeJPEG(const std::string& path) const;
+    // all stages after readImagePNG plus writeJPEG, one MCU row at a time
+    void encodeStreaming(const std::string& path);
+
+    // the same for pixels supplied by the caller: beginStream writes the headers, every streamRows call encodes
+    // the next rows (stride bytes apart, a multiple of the MCU height except for the last call), endStream completes the file
+    bool beginStream(const std::string& path);
+    void streamRows(const uint8_t* pixels, size_t stride, int rows);
+    void endStream();
+
+    // encodes caller-owned pixels in place: rows of width pixels start every stride bytes (0 for packed rows,
+    // width * bytes per pixel), they are read (like readImagePNG's, including grayscale detection and automatic
+    // subsampling) but never copied, only an MCU-high strip of planes and one MCU row of blocks are allocated;
+    // false without pixels, for a size of 0 or above MaxImageSize, a stride shorter than a row or an unwritable file
+    bool encode(const uint8_t* pixels, int width, int height, size_t stride, PixelFormat format, const std::string& path);
+    // the same for pixels in a vector, which must hold all rows (false otherwise)
+    bool encode(const std::vector<uint8_t>& pixels, int width, int height, size_t stride, PixelFormat format,
+                const std::string& path);
+
+    // prepares the encoder for another image (readImagePNG and setImageSize start with it): drops the image,
+    // its planes and blocks but keeps the options and the arena's memory, so that an image of the same size
+    // or smaller needs no allocations besides the decoder's and the output file's
+    void reset();
+    // frees the planes, blocks and arena at once (also done by the destructor)
+    void releaseWorkingMemory();
+    size_t workingMemoryHighWaterMark() const;
 };
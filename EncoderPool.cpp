@@ -0,0 +1,54 @@
+#include "EncoderPool.h"
+
+void EncoderPool::Returner::operator()(Encoder* encoder) const {
+    pool->release(encoder);
+}
+
+EncoderPool::EncoderPool(const std::function<void(Encoder&)>& configure, size_t maxIdle)
+        : configure(configure), maxIdle(maxIdle) {
+    idle.reserve(maxIdle);
+}
+
+EncoderPool::Lease EncoderPool::acquire() {
+    std::unique_ptr<Encoder> encoder;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (idle.empty()) {
+            created++;
+        } else {
+            encoder = std::move(idle.back());
+            idle.pop_back();
+        }
+    }
+
+    if (!encoder)
+        encoder.reset(new Encoder);
+
+    if (configure)
+        configure(*encoder);
+
+    return Lease(encoder.release(), Returner(this));
+}
+
+// the reset (which frees a decoded image) and the destruction of a surplus encoder happen outside the lock
+void EncoderPool::release(Encoder* encoder) {
+    std::unique_ptr<Encoder> returned(encoder);
+    returned->reset();
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (idle.size() < maxIdle)
+        idle.push_back(std::move(returned));
+}
+
+size_t EncoderPool::idleCount() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return idle.size();
+}
+
+size_t EncoderPool::createdCount() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return created;
+}
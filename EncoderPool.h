@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "Encoder.h"
+
+// hands out warm encoders to worker threads: an encoder that comes back is reset but keeps its arena, so the
+// next job of a similar size allocates no planes, strips or blocks; the pool must outlive its leases
+class EncoderPool {
+public:
+    // puts a leased encoder back into its pool when the lease goes out of scope
+    struct Returner {
+        EncoderPool* pool;
+
+        explicit Returner(EncoderPool* pool = nullptr) : pool(pool) {}
+        void operator()(Encoder* encoder) const;
+    };
+
+    typedef std::unique_ptr<Encoder, Returner> Lease;
+
+    // configure is applied to the encoder of every lease, options a job changes would carry over otherwise;
+    // at most maxIdle encoders wait in the pool, any further returned ones are destroyed
+    explicit EncoderPool(const std::function<void(Encoder&)>& configure = nullptr, size_t maxIdle = 16);
+
+    // may be called from any thread, as may the lease be released
+    Lease acquire();
+
+    size_t idleCount() const;
+    size_t createdCount() const; // encoders constructed so far, levels off once every worker has one
+
+private:
+    void release(Encoder* encoder);
+
+    std::function<void(Encoder&)> configure;
+    const size_t maxIdle;
+    mutable std::mutex mutex;
+    std::vector<std::unique_ptr<Encoder>> idle;
+    size_t created = 0;
+};
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+
+// fixed-point constants shared by the scalar and the vectorized integer kernels
+namespace FixedPoint
+{
+    // RGB -> YCbCr: coefficients are round(x * 2^ColorConstBits), small enough for signed 16-bit multiplies
+    const int ColorConstBits = 15;
+
+    // libjpeg "islow" DCT: FIX(x) = round(x * 2^DCTConstBits)
+    const int DCTConstBits = 13;
+    const int DCTPass1Bits = 2; // extra precision kept between the row and the column pass
+
+    const int32_t Fix_0_298631336 = 2446;
+    const int32_t Fix_0_390180644 = 3196;
+    const int32_t Fix_0_541196100 = 4433;
+    const int32_t Fix_0_765366865 = 6270;
+    const int32_t Fix_0_899976223 = 7373;
+    const int32_t Fix_1_175875602 = 9633;
+    const int32_t Fix_1_501321110 = 12299;
+    const int32_t Fix_1_847759065 = 15137;
+    const int32_t Fix_1_961570560 = 16069;
+    const int32_t Fix_2_053119869 = 16819;
+    const int32_t Fix_2_562915447 = 20995;
+    const int32_t Fix_3_072711026 = 25172;
+
+    // shift right by n bits, rounding to nearest
+    inline int32_t descale(int32_t x, int n) {
+        return (x + (1 << (n - 1))) >> n;
+    }
+
+    // libjpeg "ifast" DCT (AAN factorization): only 8 fractional bits, so every intermediate value fits into 16 bits
+    const int FastDCTConstBits = 8;
+
+    const int16_t FastFix_0_382683433 = 98;
+    const int16_t FastFix_0_541196100 = 139;
+    const int16_t FastFix_0_707106781 = 181;
+    const int16_t FastFix_1_306562965 = 334;
+
+    // 16x16 bit multiply, truncated back to 16 bits (no rounding, just like ifast)
+    inline int16_t fastMultiply(int16_t x, int16_t constant) {
+        return (int16_t)((x * constant) >> FastDCTConstBits);
+    }
+} // namespace FixedPoint
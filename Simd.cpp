@@ -0,0 +1,905 @@
+#include "Simd.h"
+#include "Encoder.h"
+#include "FixedPoint.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_X86
+#include <immintrin.h>
+#endif
+
+namespace Simd {
+    InstructionSet detectedInstructionSet() {
+        static const InstructionSet detected = []() {
+#ifdef SIMD_X86
+            __builtin_cpu_init();
+
+            if (__builtin_cpu_supports("avx512f"))
+                return AVX512;
+
+            if (__builtin_cpu_supports("avx2"))
+                return AVX2;
+
+            if (__builtin_cpu_supports("sse4.1"))
+                return SSE41;
+
+            if (__builtin_cpu_supports("sse2"))
+                return SSE2;
+#endif
+            return Scalar;
+        }();
+
+        return detected;
+    }
+
+    const char* instructionSetName(InstructionSet set) {
+        switch (set) {
+            case AVX512:
+                return "AVX-512";
+            case AVX2:
+                return "AVX2";
+            case SSE41:
+                return "SSE4.1";
+            case SSE2:
+                return "SSE2";
+            default:
+                return "scalar";
+        }
+    }
+} // namespace Simd
+
+#ifdef SIMD_X86
+namespace {
+    using namespace FixedPoint;
+
+    // ////////////////////////////////////////
+    // quantization in 16-bit lanes, see Divisors: the bias (one less for negative values of even divisors)
+    // takes care of the rounding, two unsigned high-half multiplies divide, then the sign is restored
+
+    __attribute__((target("sse2")))
+    void quantizeSSE2(std::array<int16_t, 64>& block, const Simd::Divisors& divisors) {
+        for (unsigned int i = 0; i < 64; i += 8) {
+            const __m128i value = _mm_loadu_si128((const __m128i*)&block[i]);
+            const __m128i sign = _mm_srai_epi16(value, 15); // -1 for negative values, 0 otherwise
+            const __m128i magnitude = _mm_sub_epi16(_mm_xor_si128(value, sign), sign); // -32768 becomes 32768 (unsigned)
+            const __m128i bias = _mm_add_epi16(_mm_loadu_si128((const __m128i*)&divisors.bias[i]),
+                                               _mm_and_si128(sign, _mm_loadu_si128((const __m128i*)&divisors.negativeBias[i])));
+            const __m128i product = _mm_mulhi_epu16(_mm_add_epi16(magnitude, bias), _mm_loadu_si128((const __m128i*)&divisors.multiplier[i]));
+            const __m128i quotient = _mm_mulhi_epu16(product, _mm_loadu_si128((const __m128i*)&divisors.scale[i]));
+
+            _mm_storeu_si128((__m128i*)&block[i], _mm_sub_epi16(_mm_xor_si128(quotient, sign), sign));
+        }
+    }
+
+    __attribute__((target("avx2")))
+    void quantizeAVX2(std::array<int16_t, 64>& block, const Simd::Divisors& divisors) {
+        for (unsigned int i = 0; i < 64; i += 16) {
+            const __m256i value = _mm256_loadu_si256((const __m256i*)&block[i]);
+            const __m256i sign = _mm256_srai_epi16(value, 15);
+            const __m256i magnitude = _mm256_abs_epi16(value);
+            const __m256i bias = _mm256_add_epi16(_mm256_loadu_si256((const __m256i*)&divisors.bias[i]),
+                                                  _mm256_and_si256(sign, _mm256_loadu_si256((const __m256i*)&divisors.negativeBias[i])));
+            const __m256i product = _mm256_mulhi_epu16(_mm256_add_epi16(magnitude, bias), _mm256_loadu_si256((const __m256i*)&divisors.multiplier[i]));
+            const __m256i quotient = _mm256_mulhi_epu16(product, _mm256_loadu_si256((const __m256i*)&divisors.scale[i]));
+
+            _mm256_storeu_si256((__m256i*)&block[i], _mm256_sign_epi16(quotient, value));
+        }
+    }
+
+    // ////////////////////////////////////////
+    // SSE4.1: one row is split into two registers (x = 0..3 and x = 4..7)
+
+    __attribute__((target("sse4.1")))
+    inline __m128i descale128(__m128i x, int n) {
+        const __m128i rounding = _mm_set1_epi32(1 << (n - 1));
+        return _mm_sra_epi32(_mm_add_epi32(x, rounding), _mm_cvtsi32_si128(n));
+    }
+
+    __attribute__((target("sse4.1")))
+    inline __m128i multiply128(__m128i x, int32_t constant) {
+        return _mm_mullo_epi32(x, _mm_set1_epi32(constant));
+    }
+
+    __attribute__((target("sse4.1")))
+    inline void transpose4x4(__m128i& a, __m128i& b, __m128i& c, __m128i& d) {
+        const __m128i t0 = _mm_unpacklo_epi32(a, b);
+        const __m128i t1 = _mm_unpacklo_epi32(c, d);
+        const __m128i t2 = _mm_unpackhi_epi32(a, b);
+        const __m128i t3 = _mm_unpackhi_epi32(c, d);
+
+        a = _mm_unpacklo_epi64(t0, t1);
+        b = _mm_unpackhi_epi64(t0, t1);
+        c = _mm_unpacklo_epi64(t2, t3);
+        d = _mm_unpackhi_epi64(t2, t3);
+    }
+
+    // rows y = 0..7 as lo[y] (x = 0..3) and hi[y] (x = 4..7) become columns x = 0..7
+    __attribute__((target("sse4.1")))
+    inline void transpose8x8(__m128i lo[8], __m128i hi[8]) {
+        transpose4x4(lo[0], lo[1], lo[2], lo[3]);
+        transpose4x4(lo[4], lo[5], lo[6], lo[7]);
+        transpose4x4(hi[0], hi[1], hi[2], hi[3]);
+        transpose4x4(hi[4], hi[5], hi[6], hi[7]);
+
+        // the upper right and lower left 4x4 quadrants swap places
+        for (unsigned int k = 0; k < 4; k++) {
+            const __m128i upperRight = hi[k];
+            hi[k] = lo[k + 4];
+            lo[k + 4] = upperRight;
+        }
+    }
+
+    // 1-D integer DCT across the eight registers d[0..7], i.e. for four columns at once
+    // (same arithmetic as integerDCTPass in Encoder.cpp)
+    __attribute__((target("sse4.1")))
+    inline void integerDCTPass128(__m128i d[8], bool rowPass) {
+        const int evenShift = rowPass ? 0 : DCTPass1Bits + 3;
+        const int oddShift = rowPass ? DCTConstBits - DCTPass1Bits : DCTConstBits + DCTPass1Bits + 3;
+
+        __m128i tmp0 = _mm_add_epi32(d[0], d[7]);
+        __m128i tmp7 = _mm_sub_epi32(d[0], d[7]);
+        __m128i tmp1 = _mm_add_epi32(d[1], d[6]);
+        __m128i tmp6 = _mm_sub_epi32(d[1], d[6]);
+        __m128i tmp2 = _mm_add_epi32(d[2], d[5]);
+        __m128i tmp5 = _mm_sub_epi32(d[2], d[5]);
+        __m128i tmp3 = _mm_add_epi32(d[3], d[4]);
+        __m128i tmp4 = _mm_sub_epi32(d[3], d[4]);
+
+        // even part
+        const __m128i tmp10 = _mm_add_epi32(tmp0, tmp3);
+        const __m128i tmp13 = _mm_sub_epi32(tmp0, tmp3);
+        const __m128i tmp11 = _mm_add_epi32(tmp1, tmp2);
+        const __m128i tmp12 = _mm_sub_epi32(tmp1, tmp2);
+
+        if (rowPass) {
+            d[0] = _mm_slli_epi32(_mm_add_epi32(tmp10, tmp11), DCTPass1Bits);
+            d[4] = _mm_slli_epi32(_mm_sub_epi32(tmp10, tmp11), DCTPass1Bits);
+        } else {
+            d[0] = descale128(_mm_add_epi32(tmp10, tmp11), evenShift);
+            d[4] = descale128(_mm_sub_epi32(tmp10, tmp11), evenShift);
+        }
+
+        __m128i z1 = multiply128(_mm_add_epi32(tmp12, tmp13), Fix_0_541196100);
+        d[2] = descale128(_mm_add_epi32(z1, multiply128(tmp13, Fix_0_765366865)), oddShift);
+        d[6] = descale128(_mm_sub_epi32(z1, multiply128(tmp12, Fix_1_847759065)), oddShift);
+
+        // odd part
+        z1 = _mm_add_epi32(tmp4, tmp7);
+        __m128i z2 = _mm_add_epi32(tmp5, tmp6);
+        __m128i z3 = _mm_add_epi32(tmp4, tmp6);
+        __m128i z4 = _mm_add_epi32(tmp5, tmp7);
+        const __m128i z5 = multiply128(_mm_add_epi32(z3, z4), Fix_1_175875602);
+
+        tmp4 = multiply128(tmp4, Fix_0_298631336);
+        tmp5 = multiply128(tmp5, Fix_2_053119869);
+        tmp6 = multiply128(tmp6, Fix_3_072711026);
+        tmp7 = multiply128(tmp7, Fix_1_501321110);
+        z1 = multiply128(z1, -Fix_0_899976223);
+        z2 = multiply128(z2, -Fix_2_562915447);
+        z3 = _mm_add_epi32(multiply128(z3, -Fix_1_961570560), z5);
+        z4 = _mm_add_epi32(multiply128(z4, -Fix_0_390180644), z5);
+
+        d[7] = descale128(_mm_add_epi32(_mm_add_epi32(tmp4, z1), z3), oddShift);
+        d[5] = descale128(_mm_add_epi32(_mm_add_epi32(tmp5, z2), z4), oddShift);
+        d[3] = descale128(_mm_add_epi32(_mm_add_epi32(tmp6, z2), z3), oddShift);
+        d[1] = descale128(_mm_add_epi32(_mm_add_epi32(tmp7, z1), z4), oddShift);
+    }
+
+    __attribute__((target("sse4.1")))
+    void integerDCTSSE41(std::array<int16_t, 64>& block) {
+        const __m128i levelShift = _mm_set1_epi32(128);
+        __m128i lo[8];
+        __m128i hi[8];
+
+        // the products need 32-bit lanes, each row of 16-bit values is widened on load and narrowed on store
+        for (unsigned int y = 0; y < 8; y++) {
+            const __m128i row = _mm_loadu_si128((const __m128i*)&block[8 * y]);
+            lo[y] = _mm_sub_epi32(_mm_cvtepi16_epi32(row), levelShift);
+            hi[y] = _mm_sub_epi32(_mm_cvtepi16_epi32(_mm_srli_si128(row, 8)), levelShift);
+        }
+
+        // registers hold columns, so a pass across registers transforms all rows at once
+        transpose8x8(lo, hi);
+        integerDCTPass128(lo, true);
+        integerDCTPass128(hi, true);
+
+        // back to rows (now indexed by horizontal frequency) for the column pass
+        transpose8x8(lo, hi);
+        integerDCTPass128(lo, false);
+        integerDCTPass128(hi, false);
+
+        for (unsigned int y = 0; y < 8; y++) {
+            _mm_storeu_si128((__m128i*)&block[8 * y], _mm_packs_epi32(lo[y], hi[y]));
+        }
+    }
+
+    // ////////////////////////////////////////
+    // AVX2: one row fits exactly into one register
+
+    __attribute__((target("avx2")))
+    inline __m256i descale256(__m256i x, int n) {
+        const __m256i rounding = _mm256_set1_epi32(1 << (n - 1));
+        return _mm256_sra_epi32(_mm256_add_epi32(x, rounding), _mm_cvtsi32_si128(n));
+    }
+
+    __attribute__((target("avx2")))
+    inline __m256i multiply256(__m256i x, int32_t constant) {
+        return _mm256_mullo_epi32(x, _mm256_set1_epi32(constant));
+    }
+
+    __attribute__((target("avx2")))
+    inline void transpose8x8(__m256i r[8]) {
+        const __m256i t0 = _mm256_unpacklo_epi32(r[0], r[1]);
+        const __m256i t1 = _mm256_unpackhi_epi32(r[0], r[1]);
+        const __m256i t2 = _mm256_unpacklo_epi32(r[2], r[3]);
+        const __m256i t3 = _mm256_unpackhi_epi32(r[2], r[3]);
+        const __m256i t4 = _mm256_unpacklo_epi32(r[4], r[5]);
+        const __m256i t5 = _mm256_unpackhi_epi32(r[4], r[5]);
+        const __m256i t6 = _mm256_unpacklo_epi32(r[6], r[7]);
+        const __m256i t7 = _mm256_unpackhi_epi32(r[6], r[7]);
+
+        const __m256i u0 = _mm256_unpacklo_epi64(t0, t2);
+        const __m256i u1 = _mm256_unpackhi_epi64(t0, t2);
+        const __m256i u2 = _mm256_unpacklo_epi64(t1, t3);
+        const __m256i u3 = _mm256_unpackhi_epi64(t1, t3);
+        const __m256i u4 = _mm256_unpacklo_epi64(t4, t6);
+        const __m256i u5 = _mm256_unpackhi_epi64(t4, t6);
+        const __m256i u6 = _mm256_unpacklo_epi64(t5, t7);
+        const __m256i u7 = _mm256_unpackhi_epi64(t5, t7);
+
+        r[0] = _mm256_permute2x128_si256(u0, u4, 0x20);
+        r[1] = _mm256_permute2x128_si256(u1, u5, 0x20);
+        r[2] = _mm256_permute2x128_si256(u2, u6, 0x20);
+        r[3] = _mm256_permute2x128_si256(u3, u7, 0x20);
+        r[4] = _mm256_permute2x128_si256(u0, u4, 0x31);
+        r[5] = _mm256_permute2x128_si256(u1, u5, 0x31);
+        r[6] = _mm256_permute2x128_si256(u2, u6, 0x31);
+        r[7] = _mm256_permute2x128_si256(u3, u7, 0x31);
+    }
+
+    // one row of 16-bit values, widened to 32 bits and level shifted
+    __attribute__((target("avx2")))
+    inline __m256i loadRow256(const int16_t* row) {
+        return _mm256_sub_epi32(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)row)), _mm256_set1_epi32(128));
+    }
+
+    // narrows a row of 32-bit values (all within 16 bits) back to 16 bits
+    __attribute__((target("avx2")))
+    inline void storeRow256(int16_t* row, __m256i values) {
+        _mm_storeu_si128((__m128i*)row, _mm_packs_epi32(_mm256_castsi256_si128(values), _mm256_extracti128_si256(values, 1)));
+    }
+
+    // 1-D integer DCT across the eight registers d[0..7], i.e. for eight columns at once
+    __attribute__((target("avx2")))
+    inline void integerDCTPass256(__m256i d[8], bool rowPass) {
+        const int evenShift = rowPass ? 0 : DCTPass1Bits + 3;
+        const int oddShift = rowPass ? DCTConstBits - DCTPass1Bits : DCTConstBits + DCTPass1Bits + 3;
+
+        __m256i tmp0 = _mm256_add_epi32(d[0], d[7]);
+        __m256i tmp7 = _mm256_sub_epi32(d[0], d[7]);
+        __m256i tmp1 = _mm256_add_epi32(d[1], d[6]);
+        __m256i tmp6 = _mm256_sub_epi32(d[1], d[6]);
+        __m256i tmp2 = _mm256_add_epi32(d[2], d[5]);
+        __m256i tmp5 = _mm256_sub_epi32(d[2], d[5]);
+        __m256i tmp3 = _mm256_add_epi32(d[3], d[4]);
+        __m256i tmp4 = _mm256_sub_epi32(d[3], d[4]);
+
+        // even part
+        const __m256i tmp10 = _mm256_add_epi32(tmp0, tmp3);
+        const __m256i tmp13 = _mm256_sub_epi32(tmp0, tmp3);
+        const __m256i tmp11 = _mm256_add_epi32(tmp1, tmp2);
+        const __m256i tmp12 = _mm256_sub_epi32(tmp1, tmp2);
+
+        if (rowPass) {
+            d[0] = _mm256_slli_epi32(_mm256_add_epi32(tmp10, tmp11), DCTPass1Bits);
+            d[4] = _mm256_slli_epi32(_mm256_sub_epi32(tmp10, tmp11), DCTPass1Bits);
+        } else {
+            d[0] = descale256(_mm256_add_epi32(tmp10, tmp11), evenShift);
+            d[4] = descale256(_mm256_sub_epi32(tmp10, tmp11), evenShift);
+        }
+
+        __m256i z1 = multiply256(_mm256_add_epi32(tmp12, tmp13), Fix_0_541196100);
+        d[2] = descale256(_mm256_add_epi32(z1, multiply256(tmp13, Fix_0_765366865)), oddShift);
+        d[6] = descale256(_mm256_sub_epi32(z1, multiply256(tmp12, Fix_1_847759065)), oddShift);
+
+        // odd part
+        z1 = _mm256_add_epi32(tmp4, tmp7);
+        __m256i z2 = _mm256_add_epi32(tmp5, tmp6);
+        __m256i z3 = _mm256_add_epi32(tmp4, tmp6);
+        __m256i z4 = _mm256_add_epi32(tmp5, tmp7);
+        const __m256i z5 = multiply256(_mm256_add_epi32(z3, z4), Fix_1_175875602);
+
+        tmp4 = multiply256(tmp4, Fix_0_298631336);
+        tmp5 = multiply256(tmp5, Fix_2_053119869);
+        tmp6 = multiply256(tmp6, Fix_3_072711026);
+        tmp7 = multiply256(tmp7, Fix_1_501321110);
+        z1 = multiply256(z1, -Fix_0_899976223);
+        z2 = multiply256(z2, -Fix_2_562915447);
+        z3 = _mm256_add_epi32(multiply256(z3, -Fix_1_961570560), z5);
+        z4 = _mm256_add_epi32(multiply256(z4, -Fix_0_390180644), z5);
+
+        d[7] = descale256(_mm256_add_epi32(_mm256_add_epi32(tmp4, z1), z3), oddShift);
+        d[5] = descale256(_mm256_add_epi32(_mm256_add_epi32(tmp5, z2), z4), oddShift);
+        d[3] = descale256(_mm256_add_epi32(_mm256_add_epi32(tmp6, z2), z3), oddShift);
+        d[1] = descale256(_mm256_add_epi32(_mm256_add_epi32(tmp7, z1), z4), oddShift);
+    }
+
+    __attribute__((target("avx2")))
+    void integerDCTAVX2(std::array<int16_t, 64>& block) {
+        __m256i rows[8];
+
+        for (unsigned int y = 0; y < 8; y++) {
+            rows[y] = loadRow256(&block[8 * y]);
+        }
+
+        // registers hold columns, so a pass across registers transforms all rows at once
+        transpose8x8(rows);
+        integerDCTPass256(rows, true);
+
+        // back to rows (now indexed by horizontal frequency) for the column pass
+        transpose8x8(rows);
+        integerDCTPass256(rows, false);
+
+        for (unsigned int y = 0; y < 8; y++) {
+            storeRow256(&block[8 * y], rows[y]);
+        }
+    }
+    // ////////////////////////////////////////
+    // batched kernels: register k of a pass holds coefficient k of 8 (AVX2) or 16 (AVX-512) different blocks
+
+    // block rows are interleaved into (and back out of) lane order with the same 8x8 transpose as above,
+    // the DCT itself runs on 64 registers without any further shuffles
+    __attribute__((target("avx2")))
+    void integerDCTBatchAVX2(std::array<int16_t, 64>* const* blocks, unsigned int count) {
+        __m256i coefficients[64];
+
+        for (unsigned int first = 0; first < count; first += 8) {
+            const unsigned int lanes = count - first < 8 ? count - first : 8;
+
+            for (unsigned int y = 0; y < 8; y++) {
+                __m256i rows[8];
+
+                // unused lanes of a partial batch transform a flat block and are discarded
+                for (unsigned int lane = 0; lane < 8; lane++) {
+                    rows[lane] = lane < lanes ? loadRow256(&(*blocks[first + lane])[8 * y]) : _mm256_setzero_si256();
+                }
+
+                transpose8x8(rows);
+
+                for (unsigned int x = 0; x < 8; x++) {
+                    coefficients[8 * y + x] = rows[x];
+                }
+            }
+
+            for (unsigned int y = 0; y < 8; y++) {
+                integerDCTPass256(&coefficients[8 * y], true);
+            }
+
+            for (unsigned int x = 0; x < 8; x++) {
+                __m256i column[8];
+
+                for (unsigned int k = 0; k < 8; k++) {
+                    column[k] = coefficients[x + 8 * k];
+                }
+
+                integerDCTPass256(column, false);
+
+                for (unsigned int k = 0; k < 8; k++) {
+                    coefficients[x + 8 * k] = column[k];
+                }
+            }
+
+            for (unsigned int y = 0; y < 8; y++) {
+                __m256i rows[8];
+
+                for (unsigned int x = 0; x < 8; x++) {
+                    rows[x] = coefficients[8 * y + x];
+                }
+
+                transpose8x8(rows);
+
+                for (unsigned int lane = 0; lane < lanes; lane++) {
+                    storeRow256(&(*blocks[first + lane])[8 * y], rows[lane]);
+                }
+            }
+        }
+    }
+
+    __attribute__((target("avx512f")))
+    inline __m512i descale512(__m512i x, int n) {
+        const __m512i rounding = _mm512_set1_epi32(1 << (n - 1));
+        return _mm512_sra_epi32(_mm512_add_epi32(x, rounding), _mm_cvtsi32_si128(n));
+    }
+
+    __attribute__((target("avx512f")))
+    inline __m512i multiply512(__m512i x, int32_t constant) {
+        return _mm512_mullo_epi32(x, _mm512_set1_epi32(constant));
+    }
+
+    // 1-D integer DCT across the eight registers d[0..7], for sixteen blocks at once
+    __attribute__((target("avx512f")))
+    inline void integerDCTPass512(__m512i d[8], bool rowPass) {
+        const int evenShift = rowPass ? 0 : DCTPass1Bits + 3;
+        const int oddShift = rowPass ? DCTConstBits - DCTPass1Bits : DCTConstBits + DCTPass1Bits + 3;
+
+        __m512i tmp0 = _mm512_add_epi32(d[0], d[7]);
+        __m512i tmp7 = _mm512_sub_epi32(d[0], d[7]);
+        __m512i tmp1 = _mm512_add_epi32(d[1], d[6]);
+        __m512i tmp6 = _mm512_sub_epi32(d[1], d[6]);
+        __m512i tmp2 = _mm512_add_epi32(d[2], d[5]);
+        __m512i tmp5 = _mm512_sub_epi32(d[2], d[5]);
+        __m512i tmp3 = _mm512_add_epi32(d[3], d[4]);
+        __m512i tmp4 = _mm512_sub_epi32(d[3], d[4]);
+
+        // even part
+        const __m512i tmp10 = _mm512_add_epi32(tmp0, tmp3);
+        const __m512i tmp13 = _mm512_sub_epi32(tmp0, tmp3);
+        const __m512i tmp11 = _mm512_add_epi32(tmp1, tmp2);
+        const __m512i tmp12 = _mm512_sub_epi32(tmp1, tmp2);
+
+        if (rowPass) {
+            d[0] = _mm512_slli_epi32(_mm512_add_epi32(tmp10, tmp11), DCTPass1Bits);
+            d[4] = _mm512_slli_epi32(_mm512_sub_epi32(tmp10, tmp11), DCTPass1Bits);
+        } else {
+            d[0] = descale512(_mm512_add_epi32(tmp10, tmp11), evenShift);
+            d[4] = descale512(_mm512_sub_epi32(tmp10, tmp11), evenShift);
+        }
+
+        __m512i z1 = multiply512(_mm512_add_epi32(tmp12, tmp13), Fix_0_541196100);
+        d[2] = descale512(_mm512_add_epi32(z1, multiply512(tmp13, Fix_0_765366865)), oddShift);
+        d[6] = descale512(_mm512_sub_epi32(z1, multiply512(tmp12, Fix_1_847759065)), oddShift);
+
+        // odd part
+        z1 = _mm512_add_epi32(tmp4, tmp7);
+        __m512i z2 = _mm512_add_epi32(tmp5, tmp6);
+        __m512i z3 = _mm512_add_epi32(tmp4, tmp6);
+        __m512i z4 = _mm512_add_epi32(tmp5, tmp7);
+        const __m512i z5 = multiply512(_mm512_add_epi32(z3, z4), Fix_1_175875602);
+
+        tmp4 = multiply512(tmp4, Fix_0_298631336);
+        tmp5 = multiply512(tmp5, Fix_2_053119869);
+        tmp6 = multiply512(tmp6, Fix_3_072711026);
+        tmp7 = multiply512(tmp7, Fix_1_501321110);
+        z1 = multiply512(z1, -Fix_0_899976223);
+        z2 = multiply512(z2, -Fix_2_562915447);
+        z3 = _mm512_add_epi32(multiply512(z3, -Fix_1_961570560), z5);
+        z4 = _mm512_add_epi32(multiply512(z4, -Fix_0_390180644), z5);
+
+        d[7] = descale512(_mm512_add_epi32(_mm512_add_epi32(tmp4, z1), z3), oddShift);
+        d[5] = descale512(_mm512_add_epi32(_mm512_add_epi32(tmp5, z2), z4), oddShift);
+        d[3] = descale512(_mm512_add_epi32(_mm512_add_epi32(tmp6, z2), z3), oddShift);
+        d[1] = descale512(_mm512_add_epi32(_mm512_add_epi32(tmp7, z1), z4), oddShift);
+    }
+
+    // same as integerDCTBatchAVX2, blocks 0..7 of a batch go to the lower and blocks 8..15 to the upper half of each register
+    __attribute__((target("avx512f")))
+    void integerDCTBatchAVX512(std::array<int16_t, 64>* const* blocks, unsigned int count) {
+        __m512i coefficients[64];
+
+        for (unsigned int first = 0; first < count; first += 16) {
+            const unsigned int lanes = count - first < 16 ? count - first : 16;
+
+            for (unsigned int y = 0; y < 8; y++) {
+                __m256i lower[8];
+                __m256i upper[8];
+
+                for (unsigned int lane = 0; lane < 8; lane++) {
+                    lower[lane] = lane < lanes ? loadRow256(&(*blocks[first + lane])[8 * y]) : _mm256_setzero_si256();
+                    upper[lane] = lane + 8 < lanes ? loadRow256(&(*blocks[first + lane + 8])[8 * y]) : _mm256_setzero_si256();
+                }
+
+                transpose8x8(lower);
+                transpose8x8(upper);
+
+                for (unsigned int x = 0; x < 8; x++) {
+                    coefficients[8 * y + x] = _mm512_inserti64x4(_mm512_castsi256_si512(lower[x]), upper[x], 1);
+                }
+            }
+
+            for (unsigned int y = 0; y < 8; y++) {
+                integerDCTPass512(&coefficients[8 * y], true);
+            }
+
+            for (unsigned int x = 0; x < 8; x++) {
+                __m512i column[8];
+
+                for (unsigned int k = 0; k < 8; k++) {
+                    column[k] = coefficients[x + 8 * k];
+                }
+
+                integerDCTPass512(column, false);
+
+                for (unsigned int k = 0; k < 8; k++) {
+                    coefficients[x + 8 * k] = column[k];
+                }
+            }
+
+            for (unsigned int y = 0; y < 8; y++) {
+                __m256i lower[8];
+                __m256i upper[8];
+
+                for (unsigned int x = 0; x < 8; x++) {
+                    lower[x] = _mm512_castsi512_si256(coefficients[8 * y + x]);
+                    upper[x] = _mm512_extracti64x4_epi64(coefficients[8 * y + x], 1);
+                }
+
+                transpose8x8(lower);
+                transpose8x8(upper);
+
+                for (unsigned int lane = 0; lane < lanes; lane++) {
+                    storeRow256(&(*blocks[first + lane])[8 * y], lane < 8 ? lower[lane] : upper[lane - 8]);
+                }
+            }
+        }
+    }
+
+    void integerDCTBatchSSE41(std::array<int16_t, 64>* const* blocks, unsigned int count) {
+        for (unsigned int i = 0; i < count; i++) {
+            integerDCTSSE41(*blocks[i]);
+        }
+    }
+
+    // ////////////////////////////////////////
+    // ifast: every value has 16 bits, so one row fits into one SSE2 register
+
+    __attribute__((target("sse2")))
+    inline void transpose8x8Words(__m128i r[8]) {
+        const __m128i t0 = _mm_unpacklo_epi16(r[0], r[1]);
+        const __m128i t1 = _mm_unpackhi_epi16(r[0], r[1]);
+        const __m128i t2 = _mm_unpacklo_epi16(r[2], r[3]);
+        const __m128i t3 = _mm_unpackhi_epi16(r[2], r[3]);
+        const __m128i t4 = _mm_unpacklo_epi16(r[4], r[5]);
+        const __m128i t5 = _mm_unpackhi_epi16(r[4], r[5]);
+        const __m128i t6 = _mm_unpacklo_epi16(r[6], r[7]);
+        const __m128i t7 = _mm_unpackhi_epi16(r[6], r[7]);
+
+        // u0: x = 0 and 1 of rows 0..3, u1: x = 2 and 3, ..., u4..u7 the same for rows 4..7
+        const __m128i u0 = _mm_unpacklo_epi32(t0, t2);
+        const __m128i u1 = _mm_unpackhi_epi32(t0, t2);
+        const __m128i u2 = _mm_unpacklo_epi32(t1, t3);
+        const __m128i u3 = _mm_unpackhi_epi32(t1, t3);
+        const __m128i u4 = _mm_unpacklo_epi32(t4, t6);
+        const __m128i u5 = _mm_unpackhi_epi32(t4, t6);
+        const __m128i u6 = _mm_unpacklo_epi32(t5, t7);
+        const __m128i u7 = _mm_unpackhi_epi32(t5, t7);
+
+        r[0] = _mm_unpacklo_epi64(u0, u4);
+        r[1] = _mm_unpackhi_epi64(u0, u4);
+        r[2] = _mm_unpacklo_epi64(u1, u5);
+        r[3] = _mm_unpackhi_epi64(u1, u5);
+        r[4] = _mm_unpacklo_epi64(u2, u6);
+        r[5] = _mm_unpackhi_epi64(u2, u6);
+        r[6] = _mm_unpacklo_epi64(u3, u7);
+        r[7] = _mm_unpackhi_epi64(u3, u7);
+    }
+
+    // same as FixedPoint::fastMultiply: the 32-bit product is put together from its low and high half
+    __attribute__((target("sse2")))
+    inline __m128i fastMultiply128(__m128i x, int16_t constant) {
+        const __m128i c = _mm_set1_epi16(constant);
+        return _mm_or_si128(_mm_slli_epi16(_mm_mulhi_epi16(x, c), 16 - FastDCTConstBits),
+                            _mm_srli_epi16(_mm_mullo_epi16(x, c), FastDCTConstBits));
+    }
+
+    // 1-D ifast DCT across the eight registers d[0..7] (same arithmetic as fastIntegerDCTPass in Encoder.cpp)
+    __attribute__((target("sse2")))
+    inline void fastIntegerDCTPass128(__m128i d[8]) {
+        const __m128i tmp0 = _mm_add_epi16(d[0], d[7]);
+        const __m128i tmp7 = _mm_sub_epi16(d[0], d[7]);
+        const __m128i tmp1 = _mm_add_epi16(d[1], d[6]);
+        const __m128i tmp6 = _mm_sub_epi16(d[1], d[6]);
+        const __m128i tmp2 = _mm_add_epi16(d[2], d[5]);
+        const __m128i tmp5 = _mm_sub_epi16(d[2], d[5]);
+        const __m128i tmp3 = _mm_add_epi16(d[3], d[4]);
+        const __m128i tmp4 = _mm_sub_epi16(d[3], d[4]);
+
+        // even part
+        const __m128i tmp10 = _mm_add_epi16(tmp0, tmp3);
+        const __m128i tmp13 = _mm_sub_epi16(tmp0, tmp3);
+        const __m128i tmp11 = _mm_add_epi16(tmp1, tmp2);
+        const __m128i tmp12 = _mm_sub_epi16(tmp1, tmp2);
+
+        d[0] = _mm_add_epi16(tmp10, tmp11);
+        d[4] = _mm_sub_epi16(tmp10, tmp11);
+
+        const __m128i z1 = fastMultiply128(_mm_add_epi16(tmp12, tmp13), FastFix_0_707106781);
+        d[2] = _mm_add_epi16(tmp13, z1);
+        d[6] = _mm_sub_epi16(tmp13, z1);
+
+        // odd part
+        const __m128i odd10 = _mm_add_epi16(tmp4, tmp5);
+        const __m128i odd11 = _mm_add_epi16(tmp5, tmp6);
+        const __m128i odd12 = _mm_add_epi16(tmp6, tmp7);
+
+        const __m128i z5 = fastMultiply128(_mm_sub_epi16(odd10, odd12), FastFix_0_382683433);
+        const __m128i z2 = _mm_add_epi16(fastMultiply128(odd10, FastFix_0_541196100), z5);
+        const __m128i z4 = _mm_add_epi16(fastMultiply128(odd12, FastFix_1_306562965), z5);
+        const __m128i z3 = fastMultiply128(odd11, FastFix_0_707106781);
+
+        const __m128i z11 = _mm_add_epi16(tmp7, z3);
+        const __m128i z13 = _mm_sub_epi16(tmp7, z3);
+
+        d[5] = _mm_add_epi16(z13, z2);
+        d[3] = _mm_sub_epi16(z13, z2);
+        d[1] = _mm_add_epi16(z11, z4);
+        d[7] = _mm_sub_epi16(z11, z4);
+    }
+
+    __attribute__((target("sse2")))
+    void fastIntegerDCTSSE2(std::array<int16_t, 64>& block) {
+        const __m128i levelShift = _mm_set1_epi16(128);
+        __m128i rows[8];
+
+        for (unsigned int y = 0; y < 8; y++) {
+            rows[y] = _mm_sub_epi16(_mm_loadu_si128((const __m128i*)&block[8 * y]), levelShift);
+        }
+
+        // same order of passes as integerDCTSSE41
+        transpose8x8Words(rows);
+        fastIntegerDCTPass128(rows);
+
+        transpose8x8Words(rows);
+        fastIntegerDCTPass128(rows);
+
+        for (unsigned int y = 0; y < 8; y++) {
+            _mm_storeu_si128((__m128i*)&block[8 * y], rows[y]);
+        }
+    }
+
+    // ////////////////////////////////////////
+    // color conversion: packed RGB24 is split into R, G and B bytes with pshufb (16 pixels from three loads),
+    // every output channel is (R, G) . (cR, cG) + (B, 0) . (cB, 0) with pmaddwd plus the bias of Encoder::ColorConversionTable
+
+    // masks[channel][load] moves byte 3p + channel of the load-th 16 bytes to byte p (-128 clears the byte)
+    __attribute__((target("sse4.1")))
+    inline void deinterleaveMasks(__m128i (&masks)[3][3]) {
+        for (int channel = 0; channel < 3; channel++) {
+            for (int load = 0; load < 3; load++) {
+                alignas(16) int8_t mask[16];
+
+                for (int p = 0; p < 16; p++) {
+                    const int index = 3 * p + channel - 16 * load;
+                    mask[p] = index >= 0 && index < 16 ? index : -128;
+                }
+
+                masks[channel][load] = _mm_load_si128((const __m128i*)mask);
+            }
+        }
+    }
+
+    __attribute__((target("sse4.1")))
+    inline void deinterleaveRGB(const uint8_t* rgb, const __m128i (&masks)[3][3], __m128i (&channels)[3]) {
+        const __m128i a = _mm_loadu_si128((const __m128i*)rgb);
+        const __m128i b = _mm_loadu_si128((const __m128i*)(rgb + 16));
+        const __m128i c = _mm_loadu_si128((const __m128i*)(rgb + 32));
+
+        for (int k = 0; k < 3; k++) {
+            channels[k] = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, masks[k][0]), _mm_shuffle_epi8(b, masks[k][1])),
+                                       _mm_shuffle_epi8(c, masks[k][2]));
+        }
+    }
+
+    // coefficient pairs and bias of output channel k (Y, Cb, Cr), one copy per 32-bit lane
+    inline int32_t redGreenCoefficients(int k) {
+        return (int32_t)((uint32_t)(uint16_t)Encoder::ColorConversionCoefficients[3 * k + 1] << 16 |
+                         (uint16_t)Encoder::ColorConversionCoefficients[3 * k]);
+    }
+
+    inline int32_t blueCoefficient(int k) {
+        return (uint16_t)Encoder::ColorConversionCoefficients[3 * k + 2];
+    }
+
+    inline int32_t colorBias(int k) {
+        return (k > 0 ? 128 << ColorConstBits : 0) + (1 << (ColorConstBits - 1));
+    }
+
+    __attribute__((target("sse4.1")))
+    void colorSSE41(const uint8_t* rgb, uint8_t* y, uint8_t* cb, uint8_t* cr, unsigned int count) {
+        uint8_t* const out[3] = { y, cb, cr };
+        __m128i masks[3][3], redGreen[3], blue[3], bias[3];
+        const __m128i zero = _mm_setzero_si128();
+        unsigned int i = 0;
+
+        deinterleaveMasks(masks);
+
+        for (int k = 0; k < 3; k++) {
+            redGreen[k] = _mm_set1_epi32(redGreenCoefficients(k));
+            blue[k] = _mm_set1_epi32(blueCoefficient(k));
+            bias[k] = _mm_set1_epi32(colorBias(k));
+        }
+
+        for (; i + 16 <= count; i += 16) {
+            __m128i channels[3], rg[4], b[4];
+            deinterleaveRGB(rgb + 3 * i, masks, channels);
+
+            for (int h = 0; h < 2; h++) {
+                const __m128i r16 = h ? _mm_unpackhi_epi8(channels[0], zero) : _mm_unpacklo_epi8(channels[0], zero);
+                const __m128i g16 = h ? _mm_unpackhi_epi8(channels[1], zero) : _mm_unpacklo_epi8(channels[1], zero);
+                const __m128i b16 = h ? _mm_unpackhi_epi8(channels[2], zero) : _mm_unpacklo_epi8(channels[2], zero);
+
+                rg[2 * h] = _mm_unpacklo_epi16(r16, g16);
+                rg[2 * h + 1] = _mm_unpackhi_epi16(r16, g16);
+                b[2 * h] = _mm_unpacklo_epi16(b16, zero);
+                b[2 * h + 1] = _mm_unpackhi_epi16(b16, zero);
+            }
+
+            for (int k = 0; k < 3; k++) {
+                __m128i sum[4];
+
+                for (int q = 0; q < 4; q++) {
+                    const __m128i products = _mm_add_epi32(_mm_madd_epi16(rg[q], redGreen[k]), _mm_madd_epi16(b[q], blue[k]));
+                    sum[q] = _mm_srai_epi32(_mm_add_epi32(products, bias[k]), ColorConstBits);
+                }
+
+                // the saturating packs clamp to 0..255
+                const __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(sum[0], sum[1]), _mm_packs_epi32(sum[2], sum[3]));
+                _mm_storeu_si128((__m128i*)(out[k] + i), bytes);
+            }
+        }
+
+        for (; i < count; i++) {
+            const Encoder::YCbCr pixel = Encoder::RGBToYCbCrWithTable(Encoder::RGB(rgb[3 * i], rgb[3 * i + 1], rgb[3 * i + 2]));
+            y[i] = pixel.y;
+            cb[i] = pixel.cb;
+            cr[i] = pixel.cr;
+        }
+    }
+
+    // same as colorSSE41 for 32 pixels at a time: the in-lane unpacks and packs cancel out,
+    // only the final byte pack needs a cross-lane permute
+    __attribute__((target("avx2")))
+    void colorAVX2(const uint8_t* rgb, uint8_t* y, uint8_t* cb, uint8_t* cr, unsigned int count) {
+        uint8_t* const out[3] = { y, cb, cr };
+        __m128i masks[3][3];
+        __m256i redGreen[3], blue[3], bias[3];
+        const __m256i zero = _mm256_setzero_si256();
+        unsigned int i = 0;
+
+        deinterleaveMasks(masks);
+
+        for (int k = 0; k < 3; k++) {
+            redGreen[k] = _mm256_set1_epi32(redGreenCoefficients(k));
+            blue[k] = _mm256_set1_epi32(blueCoefficient(k));
+            bias[k] = _mm256_set1_epi32(colorBias(k));
+        }
+
+        for (; i + 32 <= count; i += 32) {
+            __m128i channels[2][3];
+            __m256i rg[4], b[4];
+            deinterleaveRGB(rgb + 3 * i, masks, channels[0]);
+            deinterleaveRGB(rgb + 3 * i + 48, masks, channels[1]);
+
+            for (int h = 0; h < 2; h++) {
+                const __m256i r16 = _mm256_cvtepu8_epi16(channels[h][0]);
+                const __m256i g16 = _mm256_cvtepu8_epi16(channels[h][1]);
+                const __m256i b16 = _mm256_cvtepu8_epi16(channels[h][2]);
+
+                rg[2 * h] = _mm256_unpacklo_epi16(r16, g16);     // pixels 0-3 and 8-11
+                rg[2 * h + 1] = _mm256_unpackhi_epi16(r16, g16); // pixels 4-7 and 12-15
+                b[2 * h] = _mm256_unpacklo_epi16(b16, zero);
+                b[2 * h + 1] = _mm256_unpackhi_epi16(b16, zero);
+            }
+
+            for (int k = 0; k < 3; k++) {
+                __m256i sum[4];
+
+                for (int q = 0; q < 4; q++) {
+                    const __m256i products = _mm256_add_epi32(_mm256_madd_epi16(rg[q], redGreen[k]), _mm256_madd_epi16(b[q], blue[k]));
+                    sum[q] = _mm256_srai_epi32(_mm256_add_epi32(products, bias[k]), ColorConstBits);
+                }
+
+                // words are in pixel order again; the bytes come out as 0-7, 16-23, 8-15, 24-31
+                const __m256i bytes = _mm256_packus_epi16(_mm256_packs_epi32(sum[0], sum[1]), _mm256_packs_epi32(sum[2], sum[3]));
+                _mm256_storeu_si256((__m256i*)(out[k] + i), _mm256_permute4x64_epi64(bytes, _MM_SHUFFLE(3, 1, 2, 0)));
+            }
+        }
+
+        colorSSE41(rgb + 3 * i, y + i, cb + i, cr + i, count - i);
+    }
+} // end of anonymous namespace
+#endif
+
+namespace {
+    void quantizeScalar(std::array<int16_t, 64>& block, const Simd::Divisors& divisors) {
+        for (unsigned int i = 0; i < 64; i++) {
+            block[i] = Encoder::quantizeWithReciprocal(block[i], divisors.divisor[i], divisors.reciprocal[i]);
+        }
+    }
+
+    void integerDCTBatchScalar(std::array<int16_t, 64>* const* blocks, unsigned int count) {
+        for (unsigned int i = 0; i < count; i++) {
+            Encoder::transformBlockWithIntegerDCT(*blocks[i]);
+        }
+    }
+
+    void colorScalar(const uint8_t* rgb, uint8_t* y, uint8_t* cb, uint8_t* cr, unsigned int count) {
+        for (unsigned int i = 0; i < count; i++) {
+            const Encoder::YCbCr pixel = Encoder::RGBToYCbCrWithTable(Encoder::RGB(rgb[3 * i], rgb[3 * i + 1], rgb[3 * i + 2]));
+            y[i] = pixel.y;
+            cb[i] = pixel.cb;
+            cr[i] = pixel.cr;
+        }
+    }
+} // end of anonymous namespace
+
+namespace Simd {
+    BlockKernel integerDCTKernel(InstructionSet set) {
+#ifdef SIMD_X86
+        // the per-block kernel doesn't use more than eight lanes
+        if (set == AVX2 || set == AVX512)
+            return integerDCTAVX2;
+
+        if (set == SSE41)
+            return integerDCTSSE41;
+#endif
+        return Encoder::transformBlockWithIntegerDCT;
+    }
+
+    BlockKernel integerDCTKernel() {
+        static const BlockKernel kernel = integerDCTKernel(detectedInstructionSet());
+        return kernel;
+    }
+
+    BlockKernel fastIntegerDCTKernel(InstructionSet set) {
+#ifdef SIMD_X86
+        if (set != Scalar)
+            return fastIntegerDCTSSE2;
+#endif
+        return Encoder::transformBlockWithFastIntegerDCT;
+    }
+
+    BlockKernel fastIntegerDCTKernel() {
+        static const BlockKernel kernel = fastIntegerDCTKernel(detectedInstructionSet());
+        return kernel;
+    }
+
+    BatchKernel integerDCTBatchKernel(InstructionSet set) {
+#ifdef SIMD_X86
+        if (set == AVX512)
+            return integerDCTBatchAVX512;
+
+        if (set == AVX2)
+            return integerDCTBatchAVX2;
+
+        if (set == SSE41)
+            return integerDCTBatchSSE41;
+#endif
+        return integerDCTBatchScalar;
+    }
+
+    BatchKernel integerDCTBatchKernel() {
+        static const BatchKernel kernel = integerDCTBatchKernel(detectedInstructionSet());
+        return kernel;
+    }
+
+    QuantizeKernel quantizeKernel(InstructionSet set) {
+#ifdef SIMD_X86
+        if (set == AVX2 || set == AVX512)
+            return quantizeAVX2;
+
+        if (set == SSE2 || set == SSE41)
+            return quantizeSSE2;
+#endif
+        return quantizeScalar;
+    }
+
+    QuantizeKernel quantizeKernel() {
+        static const QuantizeKernel kernel = quantizeKernel(detectedInstructionSet());
+        return kernel;
+    }
+
+    ColorKernel colorKernel(InstructionSet set) {
+#ifdef SIMD_X86
+        if (set == AVX2 || set == AVX512)
+            return colorAVX2;
+
+        if (set == SSE41)
+            return colorSSE41;
+#endif
+        return colorScalar;
+    }
+
+    ColorKernel colorKernel() {
+        static const ColorKernel kernel = colorKernel(detectedInstructionSet());
+        return kernel;
+    }
+} // namespace Simd
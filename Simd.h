@@ -0,0 +1,59 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+// hand-vectorized versions of the per-block kernels in Encoder
+// the best kernel for the running CPU is picked once (cpuid), the scalar Encoder kernels are the fallback;
+// every vectorized kernel produces exactly the same output as its scalar counterpart
+namespace Simd
+{
+    enum InstructionSet { Scalar, SSE2, SSE41, AVX2, AVX512 };
+
+    // divisors d (2..32767) of one quantization table and their reciprocals, see Encoder::generateDivisors
+    struct Divisors {
+        std::array<int, 64> divisor;
+        std::array<uint32_t, 64> reciprocal; // 2^32 / 2d + 1 for Encoder::quantizeWithReciprocal
+        // the same rounded division in 16-bit lanes (Robison's division by multiplication, exact for all of int16_t):
+        // |x| / d = mulhi(mulhi(|x| + bias + (x < 0 ? negativeBias : 0), multiplier), scale)
+        std::array<uint16_t, 64> bias;
+        std::array<uint16_t, 64> negativeBias; // -1 for even d, 0 for odd d
+        std::array<uint16_t, 64> multiplier;
+        std::array<uint16_t, 64> scale; // 2^(16 - floor(log2 d))
+    };
+
+    typedef void (*BlockKernel)(std::array<int16_t, 64>& block);
+    // quantizes a block in place, see Encoder::quantizeWithReciprocal
+    typedef void (*QuantizeKernel)(std::array<int16_t, 64>& block, const Divisors& divisors);
+    // transforms count blocks, blocks[i] points to the i-th one
+    typedef void (*BatchKernel)(std::array<int16_t, 64>* const* blocks, unsigned int count);
+    // converts count packed RGB24 pixels to one row each of Y, Cb and Cr
+    typedef void (*ColorKernel)(const uint8_t* rgb, uint8_t* y, uint8_t* cb, uint8_t* cr, unsigned int count);
+
+    // best instruction set supported by the CPU and the operating system, detected on the first call
+    InstructionSet detectedInstructionSet();
+    const char* instructionSetName(InstructionSet set);
+
+    // same result as Encoder::transformBlockWithIntegerDCT
+    BlockKernel integerDCTKernel(InstructionSet set);
+    BlockKernel integerDCTKernel();
+
+    // same result as Encoder::transformBlockWithFastIntegerDCT, one row of 16-bit values per SSE2 register
+    BlockKernel fastIntegerDCTKernel(InstructionSet set);
+    BlockKernel fastIntegerDCTKernel();
+
+    // same result as Encoder::transformBlockWithIntegerDCT, but each SIMD lane holds the same coefficient
+    // of a different block: 8 blocks per step with AVX2, 16 with AVX-512 (a partial last step is padded),
+    // older instruction sets fall back to the per-block kernel
+    BatchKernel integerDCTBatchKernel(InstructionSet set);
+    BatchKernel integerDCTBatchKernel();
+
+    // same result as Encoder::quantizeBlockWithReciprocals (and therefore Encoder::quantizeBlock),
+    // 8 (SSE2) or 16 (AVX2) coefficients per instruction
+    QuantizeKernel quantizeKernel(InstructionSet set);
+    QuantizeKernel quantizeKernel();
+
+    // same result as Encoder::RGBToYCbCrWithTable, 16 (SSE4.1) or 32 (AVX2) pixels per iteration
+    ColorKernel colorKernel(InstructionSet set);
+    ColorKernel colorKernel();
+} // namespace Simd
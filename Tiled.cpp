@@ -0,0 +1,105 @@
+#include "Tiled.h"
+
+#include <sys/stat.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <vector>
+
+namespace {
+    bool createDirectory(const std::string& path) {
+        return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+    }
+
+    std::string tilePath(const std::string& directory, int row, int column) {
+        return directory + "/tile_" + std::to_string(row) + "_" + std::to_string(column) + ".jpg";
+    }
+} // end of anonymous namespace
+
+namespace Tiled {
+    bool encodeRawImage(const std::string& rawPath, int width, int height, int channels, const std::string& outPath,
+                        const std::function<void(Encoder&)>& configure) {
+        channels = channels == 1 ? 1 : 3;
+        const size_t rowBytes = (size_t)width * channels;
+        std::ifstream raw(rawPath, std::ios::in | std::ios::binary);
+
+        if (!raw || width <= 0 || height <= 0)
+            return false;
+
+        raw.seekg(0, std::ios::end);
+        if ((unsigned long long)raw.tellg() < (unsigned long long)rowBytes * height)
+            return false;
+        raw.seekg(0, std::ios::beg);
+
+        const bool tiled = width > MaxJpegSize || height > MaxJpegSize;
+        const int tileWidth = tiled ? TileSize : width;
+        const int tileHeight = tiled ? TileSize : height;
+        const int tileColumns = (width + tileWidth - 1) / tileWidth;
+
+        if (tiled && !createDirectory(outPath))
+            return false;
+
+        // strips end on MCU boundaries of every sampling mode (and on tile boundaries, which are such multiples too)
+        const size_t budgetRows = StripBytes / rowBytes / 32 * 32;
+        const int stripRows = budgetRows < 32 ? 32 : budgetRows > (size_t)tileHeight ? tileHeight : (int)budgetRows;
+        std::vector<uint8_t> strip((size_t)stripRows * rowBytes);
+        std::vector<std::unique_ptr<Encoder>> encoders(tileColumns);
+        int stripIndex = 0;
+
+        for (int tileY = 0; tileY < height; tileY += tileHeight) {
+            const int rows = std::min(tileHeight, height - tileY);
+
+            for (int column = 0; column < tileColumns; column++) {
+                const std::string path = tiled ? tilePath(outPath, tileY / tileHeight, column) : outPath;
+
+                // setImageSize resets an encoder of the tile row above, its arena is reused
+                if (!encoders[column]) {
+                    encoders[column].reset(new Encoder);
+                    configure(*encoders[column]);
+                }
+
+                encoders[column]->setImageSize(std::min(tileWidth, width - column * tileWidth), rows, channels);
+
+                if (!encoders[column]->beginStream(path))
+                    return false;
+            }
+
+            for (int y = 0; y < rows; y += stripRows) {
+                const int count = std::min(stripRows, rows - y);
+                const auto startTime = std::chrono::high_resolution_clock::now();
+
+                if (!raw.read((char*)strip.data(), (std::streamsize)(count * rowBytes)))
+                    return false;
+
+                for (int column = 0; column < tileColumns; column++) {
+                    encoders[column]->streamRows(strip.data() + (size_t)column * tileWidth * channels, rowBytes, count);
+                }
+
+                const auto endTime = std::chrono::high_resolution_clock::now();
+                const double seconds = std::chrono::duration<double>(endTime - startTime).count();
+
+                // formatted on its own stream, so std::cout keeps its flags and precision
+                if (encoders[0]->verbose) {
+                    std::ostringstream line;
+                    line << "Strip " << stripIndex << " (rows " << tileY + y << "-" << tileY + y + count - 1 << "): "
+                         << std::fixed << std::setprecision(1) << count * rowBytes / 1e6 << " MB in "
+                         << seconds * 1000 << " ms, " << count * rowBytes / 1e6 / seconds << " MB/s, "
+                         << (double)count * width / 1e6 / seconds << " MP/s";
+                    std::cout << line.str() << std::endl;
+                }
+                stripIndex++;
+            }
+
+            for (int column = 0; column < tileColumns; column++) {
+                encoders[column]->endStream();
+            }
+        }
+
+        return true;
+    }
+} // namespace Tiled
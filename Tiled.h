@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+
+#include "Encoder.h"
+
+// out-of-core encoding of raw images (packed 8-bit gray or RGB pixels, rows top to bottom, no header) of any size:
+// the file is read in horizontal strips and streamed through one Encoder per tile column, so memory stays
+// proportional to the width; images up to MaxJpegSize pixels in both directions become a single JPEG,
+// larger ones a directory of tiles named tile_<row>_<column>.jpg
+namespace Tiled
+{
+    const int MaxJpegSize = Encoder::MaxImageSize; // largest width and height the 16-bit SOF0 fields hold
+    // largest multiple of the widest MCU (32 pixels for 4:1:1) that libjpeg still decodes (up to 65500), so that
+    // only the last tile of a row or column has a partial MCU
+    const int TileSize = 65472;
+    const size_t StripBytes = 64 << 20; // raw pixels read at once (at least 32 rows)
+
+    // configure is called for every Encoder to apply the encoding options, its verbose flag enables the
+    // per-strip throughput report; returns false if the file is missing or too short, or an output can't be written
+    bool encodeRawImage(const std::string& rawPath, int width, int height, int channels, const std::string& outPath,
+                        const std::function<void(Encoder&)>& configure);
+} // namespace Tiled
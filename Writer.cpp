@@ -11,28 +11,6 @@
 #include "Writer.h"
 
 namespace {
-    // quantization tables from JPEG Standard, Annex K
-    const uint8_t DefaultQuantLuminance[8*8] = {
-            16, 11, 10, 16,  24,  40,  51,  61,
-            12, 12, 14, 19,  26,  58,  60,  55,
-            14, 13, 16, 24,  40,  57,  69,  56,
-            14, 17, 22, 29,  51,  87,  80,  62,
-            18, 22, 37, 56,  68, 109, 103,  77,
-            24, 35, 55, 64,  81, 104, 113,  92,
-            49, 64, 78, 87, 103, 121, 120, 101,
-            72, 92, 95, 98, 112, 100, 103,  99
-    };
-    const uint8_t DefaultQuantChrominance[8*8] = {
-            17, 18, 24, 47, 99, 99, 99, 99,
-            18, 21, 26, 66, 99, 99, 99, 99,
-            24, 26, 56, 99, 99, 99, 99, 99,
-            47, 66, 99, 99, 99, 99, 99, 99,
-            99, 99, 99, 99, 99, 99, 99, 99,
-            99, 99, 99, 99, 99, 99, 99, 99,
-            99, 99, 99, 99, 99, 99, 99, 99,
-            99, 99, 99, 99, 99, 99, 99, 99
-    };
-
     // static Huffman code tables from JPEG standard Annex K
     // - CodesPerBitsize tables define how many Huffman codes will have a certain bitsize (plus 1 because there nothing with zero bits),
     //   e.g. DcLuminanceCodesPerBitsize[2] = 5 because there are 5 Huffman codes being 2+1=3 bits long
@@ -157,18 +135,15 @@ namespace {
     // functions / templates
 
     // write Huffman bit codes (passed in block should already be DCT encoded, quantized, and zigzag traversed)
-    int16_t encodeBlock(BitWriter& writer, const std::array<int, 64>& block, int16_t lastDC,
+    int16_t encodeBlock(BitWriter& writer, const Encoder::Block& block, int16_t lastDC,
                         const BitCode huffmanDC[256], const BitCode huffmanAC[256], const BitCode* codewords)
     {
-        auto DC = (int16_t)block[0];
+        auto DC = block[0];
 
         // find last coefficient which is not zero (because trailing zeros are encoded differently)
-        auto posNonZero = 0;
-        for (auto i = 1; i < 8*8; i++) // start at 1 because block[0]=DC was already processed
-        {
-            if (block[i] != 0)
-                posNonZero = i;
-        }
+        auto posNonZero = 8*8 - 1;
+        while (posNonZero > 0 && block[posNonZero] == 0) // stop at 0 because block[0]=DC is processed separately
+            posNonZero--;
 
         // same "average color" as previous block ?
         auto diff = DC - lastDC;
@@ -227,24 +202,106 @@ namespace {
         }
     }
 
+    // Huffman and codeword tables only depend on the constants above, so they are generated once and shared by all writeJpeg calls
+    struct CodeTables
+    {
+        BitCode huffmanLuminanceDC[256];
+        BitCode huffmanLuminanceAC[256];
+        BitCode huffmanChrominanceDC[256];
+        BitCode huffmanChrominanceAC[256];
+        BitCode codewordsArray[2 * CodeWordLimit]; // note: quantized[i] is found at codewordsArray[quantized[i] + CodeWordLimit]
+
+        CodeTables()
+        {
+            // compute actual Huffman code tables (see Jon's code for precalculated tables)
+            generateHuffmanTable(DcLuminanceCodesPerBitsize, DcLuminanceValues, huffmanLuminanceDC);
+            generateHuffmanTable(AcLuminanceCodesPerBitsize, AcLuminanceValues, huffmanLuminanceAC);
+            generateHuffmanTable(DcChrominanceCodesPerBitsize, DcChrominanceValues, huffmanChrominanceDC);
+            generateHuffmanTable(AcChrominanceCodesPerBitsize, AcChrominanceValues, huffmanChrominanceAC);
+
+            // precompute JPEG codewords for quantized DCT
+            BitCode* codewords = &codewordsArray[CodeWordLimit]; // allow negative indices, so quantized[i] is at codewords[quantized[i]]
+            uint8_t numBits = 1; // each codeword has at least one bit (value == 0 is undefined)
+            int32_t mask    = 1; // mask is always 2^numBits - 1, initial value 2^1-1 = 2-1 = 1
+            for (int16_t value = 1; value < CodeWordLimit; value++)
+            {
+                // numBits = position of highest set bit (ignoring the sign)
+                // mask    = (2^numBits) - 1
+                if (value > mask) // one more bit ?
+                {
+                    numBits++;
+                    mask = (mask << 1) | 1; // append a set bit
+                }
+                codewords[-value] = BitCode(mask - value, numBits); // note that I use a negative index => codewords[-value] = codewordsArray[CodeWordLimit  value]
+                codewords[+value] = BitCode(       value, numBits);
+            }
+        }
+
+        const BitCode* codewords() const
+        {
+            return &codewordsArray[CodeWordLimit];
+        }
+    };
+
+    const CodeTables& codeTables()
+    {
+        static const CodeTables tables; // thread-safe one-time initialization
+        return tables;
+    }
+
 } // end of anonymous namespace
 
 namespace TooJpeg {
-    // the only exported function ...
-    bool writeJpeg(std::ofstream& wf, const std::vector<Encoder::Block>& blocks, unsigned short width, unsigned short height, const char* comment)
+    // everything that has to survive between the calls of a StreamWriter
+    struct StreamWriter::State
+    {
+        explicit State(std::ofstream& wf) : bitWriter(wf) {}
+
+        BitWriter bitWriter;
+        int numComponents = 0;
+        SamplingFactors sampling[3] = {};
+        int blocksPerMCU = 0;
+        int16_t lastDC[3] = { 0, 0, 0 }; // average color of the previous block of each component
+    };
+
+    StreamWriter::StreamWriter(std::ofstream& wf) : state(new State(wf)) {}
+
+    StreamWriter::~StreamWriter() = default;
+
+    bool StreamWriter::writeHeaders(unsigned short width, unsigned short height, int numComponents,
+                                    const SamplingFactors sampling[3], const char* comment)
     {
         // check image format
-        if (width == 0 || height == 0)
+        if (width == 0 || height == 0 || (numComponents != 1 && numComponents != 3))
             return false;
 
-        // number of components
-        const auto numComponents = 3;
         // note: if there is just one component (=grayscale), then only luminance needs to be stored in the file
         //       thus everything related to chrominance need not to be written to the JPEG
-        //       I still compute a few things, like quantization tables to avoid a complete code mess
+        const auto isRGB = numComponents == 3;
+
+        // a single component is stored non-interleaved, one block per MCU, whatever its sampling factors
+        const SamplingFactors Grayscale[1] = { { 1, 1 } };
+        if (!isRGB)
+            sampling = Grayscale;
+
+        // blocks per MCU: baseline JPEG allows sampling factors 1..4 and at most 10 blocks in an MCU
+        auto blocksPerMCU = 0;
+        for (auto c = 0; c < numComponents; c++)
+        {
+            if (sampling[c].horizontal < 1 || sampling[c].horizontal > 4 || sampling[c].vertical < 1 || sampling[c].vertical > 4)
+                return false;
+            blocksPerMCU += sampling[c].horizontal * sampling[c].vertical;
+        }
+        if (blocksPerMCU > 10)
+            return false;
+
+        state->numComponents = numComponents;
+        state->blocksPerMCU = blocksPerMCU;
+        for (auto c = 0; c < numComponents; c++)
+            state->sampling[c] = sampling[c];
 
         // wrapper for all output operations
-        BitWriter bitWriter(wf);
+        BitWriter& bitWriter = state->bitWriter;
 
         // ////////////////////////////////////////
         // JFIF headers
@@ -276,11 +333,20 @@ namespace TooJpeg {
         }
 
         // write quantization tables
-        bitWriter.addMarker(0xDB, 2 + 2 * (1 + 8*8)); // length: 65 bytes per table + 2 bytes for this length field
+        bitWriter.addMarker(0xDB, 2 + (isRGB ? 2 : 1) * (1 + 8*8)); // length: 65 bytes per table + 2 bytes for this length field
         // each table has 64 entries and is preceded by an ID byte
 
-        bitWriter   << 0x00 << DefaultQuantLuminance;   // first  quantization table
-        bitWriter << 0x01 << DefaultQuantChrominance; // second quantization table, only relevant for color images
+        // the tables are the Encoder's own (so decoders dequantize with the divisors that quantized),
+        // stored in zigzag order like the coefficients
+        bitWriter << 0x00; // first  quantization table
+        for (auto i = 0; i < 8*8; i++)
+            bitWriter << (uint8_t)Encoder::LuminanceQuantizationTable[Encoder::ZigZagTable[i]];
+        if (isRGB)
+        {
+            bitWriter << 0x01; // second quantization table, only relevant for color images
+            for (auto i = 0; i < 8*8; i++)
+                bitWriter << (uint8_t)Encoder::ChrominanceQuantizationTable[Encoder::ZigZagTable[i]];
+        }
 
         // ////////////////////////////////////////
         // write image infos (SOF0 - start of frame)
@@ -297,13 +363,13 @@ namespace TooJpeg {
         for (auto id = 1; id <= numComponents; id++)
             bitWriter <<  id                // component ID (Y=1, Cb=2, Cr=3)
                       // bitmasks for sampling: highest 4 bits: horizontal, lowest 4 bits: vertical
-                      << (id == 1 && false ? 0x22 : 0x11) // 0x11 is default YCbCr 4:4:4 and 0x22 stands for YCbCr 4:2:0
+                      << (sampling[id - 1].horizontal << 4 | sampling[id - 1].vertical) // e.g. 0x11 for all three components is YCbCr 4:4:4
                       << (id == 1 ? 0 : 1); // use quantization table 0 for Y, table 1 for Cb and Cr
 
         // ////////////////////////////////////////
         // Huffman tables
         // DHT marker - define Huffman tables
-        bitWriter.addMarker(0xC4, (2+208+208));
+        bitWriter.addMarker(0xC4, isRGB ? (2+208+208) : (2+208));
         // 2 bytes for the length field, store chrominance only if needed
         //   1+16+12  for the DC luminance
         //   1+16+162 for the AC luminance   (208 = 1+16+12 + 1+16+162)
@@ -318,26 +384,17 @@ namespace TooJpeg {
                   << AcLuminanceCodesPerBitsize
                   << AcLuminanceValues;
 
-        // compute actual Huffman code tables (see Jon's code for precalculated tables)
-        BitCode huffmanLuminanceDC[256];
-        BitCode huffmanLuminanceAC[256];
-        generateHuffmanTable(DcLuminanceCodesPerBitsize, DcLuminanceValues, huffmanLuminanceDC);
-        generateHuffmanTable(AcLuminanceCodesPerBitsize, AcLuminanceValues, huffmanLuminanceAC);
-
         // chrominance is only relevant for color images
-        BitCode huffmanChrominanceDC[256];
-        BitCode huffmanChrominanceAC[256];
-        // store luminance's DC+AC Huffman table definitions
-        bitWriter << 0x01 // highest 4 bits: 0 => DC, lowest 4 bits: 1 => Cr,Cb (baseline)
-                  << DcChrominanceCodesPerBitsize
-                  << DcChrominanceValues;
-        bitWriter << 0x11 // highest 4 bits: 1 => AC, lowest 4 bits: 1 => Cr,Cb (baseline)
-                  << AcChrominanceCodesPerBitsize
-                  << AcChrominanceValues;
-
-        // compute actual Huffman code tables (see Jon's code for precalculated tables)
-        generateHuffmanTable(DcChrominanceCodesPerBitsize, DcChrominanceValues, huffmanChrominanceDC);
-        generateHuffmanTable(AcChrominanceCodesPerBitsize, AcChrominanceValues, huffmanChrominanceAC);
+        if (isRGB)
+        {
+            // store chrominance's DC+AC Huffman table definitions
+            bitWriter << 0x01 // highest 4 bits: 0 => DC, lowest 4 bits: 1 => Cr,Cb (baseline)
+                      << DcChrominanceCodesPerBitsize
+                      << DcChrominanceValues;
+            bitWriter << 0x11 // highest 4 bits: 1 => AC, lowest 4 bits: 1 => Cr,Cb (baseline)
+                      << AcChrominanceCodesPerBitsize
+                      << AcChrominanceValues;
+        }
 
         // ////////////////////////////////////////
         // start of scan (there is only a single scan for baseline JPEGs)
@@ -354,49 +411,53 @@ namespace TooJpeg {
         static const uint8_t Spectral[3] = { 0, 63, 0 }; // spectral selection: must be from 0 to 63; successive approximation must be 0
         bitWriter << Spectral;
 
-        // ////////////////////////////////////////
-        // precompute JPEG codewords for quantized DCT
-        BitCode  codewordsArray[2 * CodeWordLimit];          // note: quantized[i] is found at codewordsArray[quantized[i] + CodeWordLimit]
-        BitCode* codewords = &codewordsArray[CodeWordLimit]; // allow negative indices, so quantized[i] is at codewords[quantized[i]]
-        uint8_t numBits = 1; // each codeword has at least one bit (value == 0 is undefined)
-        int32_t mask    = 1; // mask is always 2^numBits - 1, initial value 2^1-1 = 2-1 = 1
-        for (int16_t value = 1; value < CodeWordLimit; value++)
-        {
-            // numBits = position of highest set bit (ignoring the sign)
-            // mask    = (2^numBits) - 1
-            if (value > mask) // one more bit ?
-            {
-                numBits++;
-                mask = (mask << 1) | 1; // append a set bit
+        return true;
+    } // writeHeaders()
+
+    void StreamWriter::writeBlocks(const Encoder::Block* blocks, size_t count)
+    {
+        // Huffman code tables and JPEG codewords for quantized DCT (generated on the first call only)
+        const CodeTables& tables = codeTables();
+        const BitCode* codewords = tables.codewords();
+        const SamplingFactors* sampling = state->sampling;
+        int16_t* lastDC = state->lastDC;
+
+        // process MCUs (minimum codes units) => image is subdivided into a grid of tiles (8x8 for 4:4:4, 16x16 for 4:2:0, ...),
+        // the Encoder already stored their blocks in scan order
+        for (size_t mcu = 0; mcu + state->blocksPerMCU <= count; mcu += state->blocksPerMCU) {
+            auto block = blocks + mcu;
+
+            for (auto c = 0; c < state->numComponents; c++) {
+                // Y uses the first Huffman tables, Cb and Cr the second
+                const BitCode* huffmanDC = c == 0 ? tables.huffmanLuminanceDC : tables.huffmanChrominanceDC;
+                const BitCode* huffmanAC = c == 0 ? tables.huffmanLuminanceAC : tables.huffmanChrominanceAC;
+
+                for (auto i = 0; i < sampling[c].horizontal * sampling[c].vertical; i++)
+                    lastDC[c] = encodeBlock(state->bitWriter, *block++, lastDC[c], huffmanDC, huffmanAC, codewords);
             }
-            codewords[-value] = BitCode(mask - value, numBits); // note that I use a negative index => codewords[-value] = codewordsArray[CodeWordLimit  value]
-            codewords[+value] = BitCode(       value, numBits);
         }
+    }
 
-        // the next two variables are frequently used when checking for image borders
-        const auto maxWidth  = width  - 1; // "last row"
-        const auto maxHeight = height - 1; // "bottom line"
-
-        // process MCUs (minimum codes units) => image is subdivided into a grid of 8x8 or 16x16 tiles
-        const auto sampling = 1; // 1x1 or 2x2 sampling
-        const auto mcuSize  = 8 * sampling;
+    void StreamWriter::finish()
+    {
+        state->bitWriter.flush(); // now image is completely encoded, write any bits still left in the buffer
 
-        // average color of the previous MCU
-        int16_t lastYDC = 0, lastCbDC = 0, lastCrDC = 0;
+        // ///////////////////////////
+        // EOI marker
+        state->bitWriter << 0xFF << 0xD9; // this marker has no length, therefore I can't use addMarker()
+    }
 
-        for (const Encoder::Block& block : blocks) {
-            // encode Y channel
-            lastYDC = encodeBlock(bitWriter, block.y, lastYDC, huffmanLuminanceDC, huffmanLuminanceAC, codewords);
-            // encode Cb and Cr
-            lastCbDC = encodeBlock(bitWriter, block.cb, lastCbDC, huffmanChrominanceDC, huffmanChrominanceAC, codewords);
-            lastCrDC = encodeBlock(bitWriter, block.cr, lastCrDC, huffmanChrominanceDC, huffmanChrominanceAC, codewords);
-        }
+    // all at once
+    bool writeJpeg(std::ofstream& wf, const Encoder::BlockVector& blocks, unsigned short width, unsigned short height,
+                   int numComponents, const SamplingFactors sampling[3], const char* comment)
+    {
+        StreamWriter writer(wf);
 
-        bitWriter.flush(); // now image is completely encoded, write any bits still left in the buffer
+        if (!writer.writeHeaders(width, height, numComponents, sampling, comment))
+            return false;
 
-        // ///////////////////////////
-        // EOI marker
-        bitWriter << 0xFF << 0xD9; // this marker has no length, therefore I can't use addMarker()
+        writer.writeBlocks(blocks.data(), blocks.size());
+        writer.finish();
         return true;
     } // writeJpeg()
 } // namespace TooJpeg
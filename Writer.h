@@ -4,19 +4,50 @@
 // see https://create.stephan-brumme.com/toojpeg/
 //
 // This is a compact baseline JPEG/JFIF writer, written in C++ (but looks like C for the most part).
-// Its interface has only one function: writeJpeg() - and that's it !
+// Its interface is writeJpeg() for a whole image of blocks, or StreamWriter to write the same file MCU rows at a time.
 //
 // modified by Joseph Somerdin, 2022
 
 #pragma once
 
+#include <fstream>
+#include <memory>
+
 #include "Encoder.h"
 
 namespace TooJpeg
 {
+    // sampling factors of one component (1..4), e.g. Y 2x2 and Cb, Cr 1x1 is YCbCr 4:2:0
+    struct SamplingFactors
+    {
+        uint8_t horizontal;
+        uint8_t vertical;
+    };
+
     // wf           - output file stream (to write byte by byte)
-    // blocks       - vector of blocks that include l, cb, and cr
+    // blocks       - 8x8 blocks in scan order: per MCU the horizontal x vertical blocks of Y (row by row), then those of Cb and Cr
     // width,height - image size
+    // numComponents - 3 for YCbCr, 1 for grayscale (then blocks holds only Y blocks)
+    // sampling     - sampling factors of Y, Cb and Cr, at most 10 blocks per MCU (ignored for grayscale)
     // comment      - optional JPEG comment (0/NULL if no comment), must not contain ASCII code 0xFF
-    bool writeJpeg(std::ofstream& wf, const std::vector<Encoder::Block>& blocks, unsigned short width, unsigned short height, const char* comment = nullptr);
+    bool writeJpeg(std::ofstream& wf, const Encoder::BlockVector& blocks, unsigned short width, unsigned short height,
+                   int numComponents, const SamplingFactors sampling[3], const char* comment = nullptr);
+
+    // the same output piece by piece: writeHeaders once (same parameters as writeJpeg, returns false for an invalid format),
+    // then writeBlocks for the MCUs in scan order, as many complete MCUs per call as convenient, finally finish
+    class StreamWriter
+    {
+    public:
+        explicit StreamWriter(std::ofstream& wf);
+        ~StreamWriter();
+
+        bool writeHeaders(unsigned short width, unsigned short height, int numComponents,
+                          const SamplingFactors sampling[3], const char* comment = nullptr);
+        void writeBlocks(const Encoder::Block* blocks, size_t count);
+        void finish();
+
+    private:
+        struct State;
+        std::unique_ptr<State> state;
+    };
 } // namespace TooJpeg
@@ -1,6 +1,8 @@
 #include "Encoder.h"
+#include "Tiled.h"
 #include <iostream>
 #include <chrono>
+#include <cstdio>
 #include <fstream>
 #include <string>
 
@@ -12,11 +14,78 @@ int getFileSizeInBytes(const std::string& path) {
     return (int)(end - begin);
 }
 
+bool parseDCTMethod(const std::string& name, Encoder::DCTMethod& method) {
+    if (name == "reference")
+        method = Encoder::ReferenceDCT;
+    else if (name == "separable")
+        method = Encoder::SeparableDCT;
+    else if (name == "aan")
+        method = Encoder::AANDCT;
+    else if (name == "integer")
+        method = Encoder::IntegerDCT;
+    else if (name == "fastinteger")
+        method = Encoder::FastIntegerDCT;
+    else
+        return false;
+
+    return true;
+}
+
+bool parseDCTPrecision(const std::string& name, Encoder::DCTPrecision& precision) {
+    if (name == "double")
+        precision = Encoder::DoublePrecision;
+    else if (name == "float")
+        precision = Encoder::FloatPrecision;
+    else if (name == "fixed32")
+        precision = Encoder::Fixed32Precision;
+    else if (name == "fixed16")
+        precision = Encoder::Fixed16Precision;
+    else
+        return false;
+
+    return true;
+}
+
+bool parseChromaSubsampling(const std::string& name, Encoder::ChromaSubsampling& subsampling) {
+    if (name == "auto")
+        subsampling = Encoder::AutomaticSubsampling;
+    else if (name == "444")
+        subsampling = Encoder::Subsampling444;
+    else if (name == "422")
+        subsampling = Encoder::Subsampling422;
+    else if (name == "420")
+        subsampling = Encoder::Subsampling420;
+    else if (name == "440")
+        subsampling = Encoder::Subsampling440;
+    else if (name == "411")
+        subsampling = Encoder::Subsampling411;
+    else
+        return false;
+
+    return true;
+}
+
+// WIDTHxHEIGHT or WIDTHxHEIGHTxCHANNELS (1 or 3, default 3)
+bool parseRawFormat(const std::string& format, int& width, int& height, int& channels) {
+    char separator1 = 0, separator2 = 0;
+    channels = 3;
+
+    const int fields = std::sscanf(format.c_str(), "%d%c%d%c%d", &width, &separator1, &height, &separator2, &channels);
+    if (fields != 3 && fields != 5)
+        return false;
+
+    return separator1 == 'x' && (fields == 3 || separator2 == 'x') && width > 0 && height > 0 && (channels == 1 || channels == 3);
+}
+
 int main(int argc, char *argv[]) {
     /* Input validation */
 
     if (argc < 3) {
         std::cout << "Input and output file paths must be provided." << std::endl;
+        std::cout << "Usage: encoder <input> <output> [--dct=reference|separable|aan|integer|fastinteger]" << std::endl;
+        std::cout << "               [--precision=double|float|fixed32|fixed16] [--color=reference|fixed]" << std::endl;
+        std::cout << "               [--subsampling=auto|444|422|420|440|411] [--batched-dct] [--separate-stages] [--streaming]" << std::endl;
+        std::cout << "               [--raw=WIDTHxHEIGHT[x1|x3]] (headerless input, larger than 65535 pixels: output is a directory of tiles)" << std::endl;
         return -1;
     }
 
@@ -26,22 +95,96 @@ int main(int argc, char *argv[]) {
     /* Encoding */
 
     Encoder encoder;
+    bool separateStages = false;
+    bool streaming = false;
+    int rawWidth = 0, rawHeight = 0, rawChannels = 0;
+
+    for (int i = 3; i < argc; i++) {
+        const std::string arg = argv[i];
+        Encoder::DCTMethod method;
+        Encoder::DCTPrecision precision;
+        Encoder::ChromaSubsampling subsampling;
+
+        if (arg.compare(0, 6, "--dct=") == 0 && parseDCTMethod(arg.substr(6), method)) {
+            encoder.setDCTMethod(method);
+        } else if (arg.compare(0, 12, "--precision=") == 0 && parseDCTPrecision(arg.substr(12), precision)) {
+            encoder.setDCTPrecision(precision);
+        } else if (arg == "--color=reference" || arg == "--color=fixed") {
+            encoder.setColorConversion(arg == "--color=fixed" ? Encoder::FixedPointColorConversion : Encoder::ReferenceColorConversion);
+        } else if (arg.compare(0, 14, "--subsampling=") == 0 && parseChromaSubsampling(arg.substr(14), subsampling)) {
+            encoder.setChromaSubsampling(subsampling);
+        } else if (arg == "--batched-dct") {
+            encoder.setBatchedDCT(true);
+        } else if (arg == "--separate-stages") {
+            separateStages = true;
+        } else if (arg == "--streaming") {
+            streaming = true;
+        } else if (arg.compare(0, 6, "--raw=") == 0 && parseRawFormat(arg.substr(6), rawWidth, rawHeight, rawChannels)) {
+            // handled below
+        } else {
+            std::cout << "Unknown option: " << arg << std::endl;
+            return -1;
+        }
+    }
 
     auto startTime = std::chrono::high_resolution_clock::now();
 
+    // out-of-core: every tile gets an Encoder of its own with the options above
+    if (rawWidth > 0) {
+        const auto configure = [&encoder](Encoder& tile) {
+            tile.setColorConversion(encoder.colorConversion);
+            tile.setChromaSubsampling(encoder.chromaSubsampling);
+            tile.setDCTMethod(encoder.dctMethod);
+            tile.setBatchedDCT(encoder.batchedDCT);
+            tile.setVerbose(encoder.verbose);
+        };
+
+        if (!Tiled::encodeRawImage(inPath, rawWidth, rawHeight, rawChannels, outPath, configure)) {
+            std::cout << "Raw image could not be encoded." << std::endl;
+            return -1;
+        }
+
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - startTime);
+        std::cout << "Total encoding time: " << duration.count() << " ms" << std::endl;
+        return 0;
+    }
+
     try {
         encoder.readImagePNG(inPath);
     } catch (...) {
         std::cout << "File could not be read." << std::endl;
+        return -1;
     }
 
-    encoder.convertColorspace();
-    encoder.createPaddedImage();
-    encoder.generateBlocks();
-    encoder.transformBlocksWithDCT();
-    encoder.quantizeBlocks();
-    encoder.zigZagVectorizeBlocks();
-    encoder.writeJPEG(outPath);
+    if (streaming) {
+        // all stages interleaved one MCU row at a time, only the total time can be measured
+        encoder.encodeStreaming(outPath);
+    } else {
+        // the separate stages produce the same blocks as the fused ones, one stage at a time (for debugging)
+        if (separateStages) {
+            encoder.convertColorspace();
+            encoder.createPaddedImage();
+            encoder.generateBlocks();
+        } else {
+            encoder.convertColorspaceAndGenerateBlocks();
+        }
+
+        auto dctStartTime = std::chrono::high_resolution_clock::now();
+
+        if (separateStages) {
+            encoder.transformBlocksWithDCT();
+            encoder.quantizeBlocks();
+            encoder.zigZagVectorizeBlocks();
+        } else {
+            encoder.transformQuantizeAndZigZagBlocks();
+        }
+
+        auto dctEndTime = std::chrono::high_resolution_clock::now();
+        encoder.writeJPEG(outPath);
+
+        auto dctDuration = std::chrono::duration_cast<std::chrono::milliseconds>(dctEndTime - dctStartTime);
+        std::cout << "DCT, quantization and zigzag time: " << dctDuration.count() << " ms" << std::endl;
+    }
 
     auto endTime = std::chrono::high_resolution_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime);
@@ -57,6 +200,7 @@ int main(int argc, char *argv[]) {
     std::cout << "Uncompressed image size: " << uncompressedSizeInBytes << " bytes" << std::endl;
     std::cout << "Compressed image size: " << compressedSizeInBytes << " bytes" << std::endl;
     std::cout << "Compression ratio: " << (double)uncompressedSizeInBytes / (double)compressedSizeInBytes << std::endl;
+    std::cout << "Working memory (arena high-water mark): " << encoder.workingMemoryHighWaterMark() << " bytes" << std::endl;
 
     return 0;
 }
@@ -0,0 +1,180 @@
+// encodes every input image with every DCT method and compares them against the calcDCTCoefficient reference:
+// deviation of the coefficients before quantization, PSNR of the decoded JPEG and throughput of the transform stage
+// usage: report <image> [<image> ...]
+
+#include "Encoder.h"
+#include "stb_image.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+struct Mode {
+    const char* name;
+    const char* precision;
+    Encoder::DCTMethod method;
+};
+
+const Mode Modes[] = {
+        { "reference",   "double",  Encoder::ReferenceDCT },
+        { "separable",   "double",  Encoder::SeparableDCT },
+        { "aan",         "float",   Encoder::AANDCT },
+        { "integer",     "fixed32", Encoder::IntegerDCT },
+        { "fastinteger", "fixed16", Encoder::FastIntegerDCT }
+};
+
+const char* TemporaryPath = "report.jpg";
+
+const int UnitQuantizationTable[64] = {
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1
+};
+
+// divides the AAN output scaling 8 * s(i) * s(j) out without quantizing
+const std::array<float, 64> UnitAANScaleTable = Encoder::generateAANScaleTable(UnitQuantizationTable);
+
+// peak signal-to-noise ratio of the decoded JPEG at path against the image at originalPath
+double calcPSNR(const std::string& path, const std::string& originalPath) {
+    int width, height, originalWidth, originalHeight;
+    uint8_t* decoded = stbi_load(path.c_str(), &width, &height, nullptr, 3);
+    uint8_t* original = stbi_load(originalPath.c_str(), &originalWidth, &originalHeight, nullptr, 3);
+    const size_t values = 3 * (size_t)width * height;
+
+    if (decoded == nullptr || original == nullptr || width != originalWidth || height != originalHeight) {
+        stbi_image_free(decoded);
+        stbi_image_free(original);
+        return 0;
+    }
+
+    double squaredError = 0;
+    for (size_t i = 0; i < values; i++) {
+        const double difference = decoded[i] - original[i];
+        squaredError += difference * difference;
+    }
+
+    stbi_image_free(decoded);
+    stbi_image_free(original);
+
+    const double meanSquaredError = squaredError / values;
+    if (meanSquaredError == 0)
+        return INFINITY;
+
+    return 10 * std::log10(255.0 * 255.0 / meanSquaredError);
+}
+
+// the transform of a method without quantization, at the scale of calcDCTCoefficient
+void transformUnquantized(Encoder::DCTMethod method, Encoder::Block& block) {
+    switch (method) {
+        case Encoder::ReferenceDCT:
+            Encoder::transformBlockWithDCT(block);
+            break;
+        case Encoder::SeparableDCT:
+            Encoder::transformBlockWithSeparableDCT(block);
+            break;
+        case Encoder::AANDCT:
+            Encoder::transformBlockWithAANDCT(block, UnitAANScaleTable);
+            break;
+        case Encoder::IntegerDCT:
+            Encoder::transformBlockWithIntegerDCT(block);
+            break;
+        case Encoder::FastIntegerDCT:
+            Encoder::transformBlockWithFastIntegerDCT(block);
+
+            for (unsigned int i = 0; i < 8; i++) {
+                for (unsigned int j = 0; j < 8; j++) {
+                    const double scale = 8 * Encoder::aanScaleFactor(i) * Encoder::aanScaleFactor(j);
+                    block[Encoder::getIndex(i, j, 8)] = (int16_t)Encoder::round(block[Encoder::getIndex(i, j, 8)] / scale);
+                }
+            }
+            break;
+    }
+}
+
+void accumulateDeviation(const Encoder::Block& block, const Encoder::Block& reference, int& maxDeviation, double& sumDeviation) {
+    for (unsigned int i = 0; i < 64; i++) {
+        const int deviation = std::abs(block[i] - reference[i]);
+        maxDeviation = std::max(maxDeviation, deviation);
+        sumDeviation += deviation;
+    }
+}
+
+void reportImage(const std::string& path) {
+    Encoder encoder;
+    encoder.setVerbose(false);
+
+    try {
+        encoder.readImagePNG(path);
+    } catch (...) {
+        std::cout << path << ": file could not be read." << std::endl;
+        return;
+    }
+
+    encoder.convertColorspace();
+    encoder.createPaddedImage();
+    encoder.generateBlocks();
+
+    const std::vector<Encoder::Block> samples(encoder.blocks.begin(), encoder.blocks.end());
+    std::vector<Encoder::Block> reference = samples;
+
+    for (Encoder::Block& block : reference) {
+        transformUnquantized(Encoder::ReferenceDCT, block);
+    }
+
+    std::cout << path << " (" << encoder.width << "x" << encoder.height << ", " << samples.size() << " blocks)" << std::endl;
+    std::cout << std::left << std::setw(14) << "  mode" << std::setw(10) << "precision"
+              << std::right << std::setw(10) << "max dev" << std::setw(12) << "mean dev"
+              << std::setw(12) << "PSNR (dB)" << std::setw(14) << "blocks/s" << std::endl;
+
+    for (const Mode& mode : Modes) {
+        int maxDeviation = 0;
+        double sumDeviation = 0;
+
+        for (size_t i = 0; i < samples.size(); i++) {
+            Encoder::Block block = samples[i];
+            transformUnquantized(mode.method, block);
+            accumulateDeviation(block, reference[i], maxDeviation, sumDeviation);
+        }
+
+        encoder.blocks.assign(samples.begin(), samples.end());
+        encoder.setDCTMethod(mode.method);
+
+        const auto startTime = std::chrono::high_resolution_clock::now();
+        encoder.transformQuantizeAndZigZagBlocks();
+        const auto endTime = std::chrono::high_resolution_clock::now();
+        const double seconds = std::chrono::duration<double>(endTime - startTime).count();
+
+        encoder.writeJPEG(TemporaryPath);
+        const double psnr = calcPSNR(TemporaryPath, path);
+        std::remove(TemporaryPath);
+
+        std::cout << "  " << std::left << std::setw(12) << mode.name << std::setw(10) << mode.precision
+                  << std::right << std::setw(10) << maxDeviation
+                  << std::setw(12) << std::fixed << std::setprecision(5) << sumDeviation / (64.0 * encoder.blocks.size())
+                  << std::setw(12) << std::setprecision(3) << psnr
+                  << std::setw(14) << std::setprecision(0) << encoder.blocks.size() / seconds << std::endl;
+    }
+
+    std::cout << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        std::cout << "Usage: report <image> [<image> ...]" << std::endl;
+        return -1;
+    }
+
+    std::cout << "Coefficient deviation is measured before quantization against calcDCTCoefficient"
+              << " (the AAN and ifast outputs divided by 8 * s(i) * s(j) and rounded)." << std::endl;
+    std::cout << std::endl;
+
+    for (int i = 1; i < argc; i++) {
+        reportImage(argv[i]);
+    }
+
+    return 0;
+}
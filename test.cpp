@@ -0,0 +1,600 @@
+// checks the fast kernels against the reference paths they replace
+// usage: tests (exit status 0 if every check passed)
+
+#include "Encoder.h"
+#include "EncoderPool.h"
+#include "Simd.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+int failures = 0;
+
+void check(bool passed, const std::string& name) {
+    std::cout << (passed ? "  ok    " : "  FAIL  ") << name << std::endl;
+    failures += passed ? 0 : 1;
+}
+
+// random, flat and extreme (only 0 and 255, including both checkerboards) 8-bit sample blocks
+std::vector<Encoder::Block> generateSampleBlocks() {
+    std::mt19937 random(2024);
+    std::uniform_int_distribution<int> sample(0, 255);
+    std::vector<Encoder::Block> blocks;
+    Encoder::Block block;
+
+    for (int n = 0; n < 20000; n++) {
+        for (auto& value : block) value = (int16_t)sample(random);
+        blocks.push_back(block);
+    }
+
+    for (int value = 0; value < 256; value++) {
+        block.fill((int16_t)value);
+        blocks.push_back(block);
+    }
+
+    for (int n = 0; n < 20000; n++) {
+        for (auto& value : block) value = (int16_t)(random() & 1 ? 255 : 0);
+        blocks.push_back(block);
+    }
+
+    for (unsigned int i = 0; i < 64; i++) {
+        block[i] = (int16_t)((i % 8 + i / 8) % 2 ? 255 : 0);
+    }
+    blocks.push_back(block);
+
+    for (auto& value : block) value = (int16_t)(255 - value);
+    blocks.push_back(block);
+
+    return blocks;
+}
+
+// largest coefficient difference of a transform against calcDCTCoefficient
+int maxDCTDeviation(void (*transform)(Encoder::Block&), const std::vector<Encoder::Block>& samples) {
+    int maxDeviation = 0;
+
+    for (const Encoder::Block& sample : samples) {
+        Encoder::Block reference = sample;
+        Encoder::Block block = sample;
+        Encoder::transformBlockWithDCT(reference);
+        transform(block);
+
+        for (unsigned int i = 0; i < 64; i++) {
+            maxDeviation = std::max(maxDeviation, std::abs(block[i] - reference[i]));
+        }
+    }
+
+    return maxDeviation;
+}
+
+void testIntegerDCT(const std::vector<Encoder::Block>& samples) {
+    const int maxDeviation = maxDCTDeviation(Encoder::transformBlockWithIntegerDCT, samples);
+    check(maxDeviation <= 1, "integer DCT within 1 of the reference DCT (max " + std::to_string(maxDeviation) + ")");
+}
+
+// the instruction sets this CPU can run, Scalar first
+std::vector<Simd::InstructionSet> supportedInstructionSets() {
+    std::vector<Simd::InstructionSet> sets;
+
+    for (int set = Simd::Scalar; set <= Simd::detectedInstructionSet(); set++) {
+        sets.push_back((Simd::InstructionSet)set);
+    }
+
+    return sets;
+}
+
+// a vectorized kernel must reproduce the scalar one exactly (sets without a kernel of their own are skipped)
+bool sameAsScalarKernel(Simd::BlockKernel kernel, Simd::BlockKernel scalar, const std::vector<Encoder::Block>& samples) {
+    for (const Encoder::Block& sample : samples) {
+        Encoder::Block expected = sample;
+        Encoder::Block block = sample;
+        scalar(expected);
+        kernel(block);
+
+        if (block != expected)
+            return false;
+    }
+
+    return true;
+}
+
+void testIntegerDCTKernels(const std::vector<Encoder::Block>& samples) {
+    const Simd::BlockKernel scalar = Simd::integerDCTKernel(Simd::Scalar);
+
+    for (Simd::InstructionSet set : supportedInstructionSets()) {
+        if (Simd::integerDCTKernel(set) != scalar)
+            check(sameAsScalarKernel(Simd::integerDCTKernel(set), scalar, samples),
+                  std::string(Simd::instructionSetName(set)) + " integer DCT equals the scalar kernel");
+    }
+}
+
+void testFastIntegerDCTKernels(const std::vector<Encoder::Block>& samples) {
+    const Simd::BlockKernel scalar = Simd::fastIntegerDCTKernel(Simd::Scalar);
+
+    for (Simd::InstructionSet set : supportedInstructionSets()) {
+        if (Simd::fastIntegerDCTKernel(set) != scalar)
+            check(sameAsScalarKernel(Simd::fastIntegerDCTKernel(set), scalar, samples),
+                  std::string(Simd::instructionSetName(set)) + " ifast DCT equals the scalar kernel");
+    }
+}
+
+// the batched kernels against the per-block transform for every batch size 0..41, so that full steps of 8 and 16
+// lanes and all partial last steps run; the pointers go in reverse order, the blocks around them must stay untouched
+void testIntegerDCTBatchKernels(const std::vector<Encoder::Block>& samples) {
+    for (Simd::InstructionSet set : supportedInstructionSets()) {
+        const Simd::BatchKernel kernel = Simd::integerDCTBatchKernel(set);
+        bool same = true;
+
+        for (size_t first = 0; first + 43 <= samples.size(); first += 997) {
+            for (unsigned int count = 0; count <= 41; count++) {
+                std::vector<Encoder::Block> blocks(samples.begin() + first, samples.begin() + first + count + 2);
+                std::vector<Encoder::Block*> pointers;
+
+                for (unsigned int i = count; i > 0; i--) {
+                    pointers.push_back(&blocks[i]);
+                }
+
+                kernel(pointers.data(), count);
+
+                for (unsigned int i = 0; i < count + 2; i++) {
+                    Encoder::Block expected = samples[first + i];
+                    if (i >= 1 && i <= count)
+                        Encoder::transformBlockWithIntegerDCT(expected);
+
+                    same = same && blocks[i] == expected;
+                }
+            }
+        }
+
+        check(same, std::string(Simd::instructionSetName(set)) + " batched integer DCT equals the per-block transform for 0..41 blocks");
+    }
+}
+
+// every int16_t value in every position of both quantization tables
+void testReciprocalQuantizer() {
+    const Encoder::PixelType types[2] = { Encoder::Luminance, Encoder::Chrominance };
+    const Simd::Divisors* divisors[2] = { &Encoder::LuminanceDivisors, &Encoder::ChrominanceDivisors };
+    long mismatches = 0;
+
+    for (int t = 0; t < 2; t++) {
+        for (int value = -32768; value <= 32767; value++) {
+            Encoder::Block block;
+            block.fill((int16_t)value);
+            Encoder::quantizeBlock(block, types[t]);
+
+            for (unsigned int i = 0; i < 64; i++) {
+                const int expected = Encoder::quantizeWithReciprocal(value, divisors[t]->divisor[i], divisors[t]->reciprocal[i]);
+                mismatches += block[i] != expected;
+            }
+        }
+    }
+
+    check(mismatches == 0, "reciprocal quantizer equals quantizeBlock for all of int16_t");
+}
+
+// the 16-bit quantizer kernels against quantizeWithReciprocal: every int16_t value in every lane of all four divisor tables
+void testQuantizeKernels() {
+    const Simd::Divisors* tables[4] = {
+            &Encoder::LuminanceDivisors, &Encoder::ChrominanceDivisors,
+            &Encoder::FastIntegerLuminanceDivisors, &Encoder::FastIntegerChrominanceDivisors
+    };
+
+    for (Simd::InstructionSet set : supportedInstructionSets()) {
+        const Simd::QuantizeKernel kernel = Simd::quantizeKernel(set);
+        long mismatches = 0;
+
+        for (const Simd::Divisors* divisors : tables) {
+            for (int value = -32768; value <= 32767; value++) {
+                Encoder::Block block;
+                block.fill((int16_t)value);
+                kernel(block, *divisors);
+
+                for (unsigned int i = 0; i < 64; i++) {
+                    mismatches += block[i] != Encoder::quantizeWithReciprocal(value, divisors->divisor[i], divisors->reciprocal[i]);
+                }
+            }
+        }
+
+        check(mismatches == 0, std::string(Simd::instructionSetName(set)) + " quantizer equals quantizeWithReciprocal for all of int16_t");
+    }
+}
+
+// a block of the given type after the full DCT of method and, if quantized, the quantizer and the zigzag reordering
+// (the AAN DCT always quantizes)
+Encoder::Block transformInFull(Encoder::DCTMethod method, Encoder::PixelType type, Encoder::Block block, bool quantize) {
+    const bool luminance = type == Encoder::Luminance;
+    const Simd::QuantizeKernel quantizer = Simd::quantizeKernel(Simd::Scalar);
+
+    switch (method) {
+        case Encoder::AANDCT:
+            Encoder::transformBlockWithAANDCT(block, luminance ? Encoder::AANLuminanceScaleTable : Encoder::AANChrominanceScaleTable);
+            break;
+        case Encoder::IntegerDCT:
+            Encoder::transformBlockWithIntegerDCT(block);
+            if (quantize)
+                quantizer(block, luminance ? Encoder::LuminanceDivisors : Encoder::ChrominanceDivisors);
+            break;
+        case Encoder::FastIntegerDCT:
+            Encoder::transformBlockWithFastIntegerDCT(block);
+            if (quantize)
+                quantizer(block, luminance ? Encoder::FastIntegerLuminanceDivisors : Encoder::FastIntegerChrominanceDivisors);
+            break;
+        default:
+            Encoder::transformBlockWithSeparableDCT(block);
+            if (quantize)
+                quantizer(block, luminance ? Encoder::LuminanceDivisors : Encoder::ChrominanceDivisors);
+            break;
+    }
+
+    if (quantize)
+        Encoder::zigZagVectorizeBlock(block);
+
+    return block;
+}
+
+// the flat block shortcut of every method against its full transform, for every DC value and both block types:
+// once in the fused stage (quantized and reordered) and once in transformBlocksWithDCT (only transformed)
+void testFlatBlocks() {
+    const Encoder::DCTMethod methods[4] = { Encoder::SeparableDCT, Encoder::AANDCT, Encoder::IntegerDCT, Encoder::FastIntegerDCT };
+    const char* names[4] = { "separable", "AAN", "integer", "ifast" };
+
+    for (int m = 0; m < 4; m++) {
+        for (int fused = 0; fused < 2; fused++) {
+            Encoder encoder;
+            encoder.setVerbose(false);
+            encoder.setDCTMethod(methods[m]);
+            encoder.components = 3; // 4:4:4 MCUs: one Y, one Cb and one Cr block
+            std::vector<Encoder::Block> samples;
+
+            for (int value = 0; value < 256; value++) {
+                Encoder::Block block;
+                block.fill((int16_t)value);
+                samples.insert(samples.end(), 3, block);
+            }
+
+            encoder.blocks.assign(samples.begin(), samples.end());
+            if (fused)
+                encoder.transformQuantizeAndZigZagBlocks();
+            else
+                encoder.transformBlocksWithDCT();
+
+            bool same = encoder.flatBlockCount == samples.size();
+            for (size_t i = 0; i < samples.size(); i++) {
+                const Encoder::PixelType type = i % 3 == 0 ? Encoder::Luminance : Encoder::Chrominance;
+                same = same && encoder.blocks[i] == transformInFull(methods[m], type, samples[i], fused || methods[m] == Encoder::AANDCT);
+            }
+
+            check(same, std::string(names[m]) + " flat block shortcut equals the full " + (fused ? "DCT, quantizer and zigzag" : "DCT"));
+        }
+    }
+}
+
+// noisy gradients of the given size, photographic enough for automatic 4:2:0 (channels 1 for gray, 3 for RGB)
+struct TestImage {
+    std::vector<uint8_t> pixels;
+    int width;
+    int height;
+    int channels;
+};
+
+TestImage generateImage(int width, int height, int channels) {
+    std::mt19937 random(width * 65536 + height);
+    std::uniform_int_distribution<int> noise(-24, 24);
+    TestImage image = { std::vector<uint8_t>((size_t)width * height * channels), width, height, channels };
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            for (int c = 0; c < channels; c++) {
+                const int value = (x * (c + 1) * 255 / width + y * (3 - c) * 255 / height) / 3 + noise(random);
+                image.pixels[((size_t)y * width + x) * channels + c] = (uint8_t)std::min(255, std::max(0, value));
+            }
+        }
+    }
+
+    return image;
+}
+
+// the image as readImagePNG would leave it (imageRGB is released with stbi_image_free, which is free)
+void loadImage(Encoder& encoder, const TestImage& image) {
+    encoder.setImageSize(image.width, image.height, image.channels);
+    encoder.imageRGB.reset(static_cast<uint8_t*>(std::malloc(image.pixels.size())));
+    std::copy(image.pixels.begin(), image.pixels.end(), encoder.imageRGB.get());
+}
+
+const char* const OutputPath = "tests_output.jpg";
+
+// the bytes of the file last written to path, which is removed
+std::vector<uint8_t> takeOutput(const std::string& path = OutputPath) {
+    std::ifstream file(path, std::ios::binary);
+    std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    file.close();
+    std::remove(path.c_str());
+    return bytes;
+}
+
+enum Pipeline { FusedStages, SeparateStages, Streaming, CallerPixels };
+
+std::vector<uint8_t> encodeWith(Encoder& encoder, Pipeline pipeline, const TestImage& image, const std::string& path = OutputPath) {
+    if (pipeline == CallerPixels) {
+        const Encoder::PixelFormat format = image.channels == 1 ? Encoder::Gray8 : Encoder::RGB24;
+        encoder.encode(image.pixels, image.width, image.height, (size_t)image.width * image.channels, format, path);
+        return takeOutput(path);
+    }
+
+    loadImage(encoder, image);
+
+    if (pipeline == Streaming) {
+        encoder.encodeStreaming(path);
+    } else if (pipeline == SeparateStages) {
+        encoder.convertColorspace();
+        encoder.createPaddedImage();
+        encoder.generateBlocks();
+        encoder.transformBlocksWithDCT();
+        encoder.quantizeBlocks();
+        encoder.zigZagVectorizeBlocks();
+        encoder.writeJPEG(path);
+    } else {
+        encoder.convertColorspaceAndGenerateBlocks();
+        encoder.transformQuantizeAndZigZagBlocks();
+        encoder.writeJPEG(path);
+    }
+
+    return takeOutput(path);
+}
+
+std::vector<uint8_t> encodeWith(Pipeline pipeline, const TestImage& image, Encoder::ChromaSubsampling subsampling,
+                                Encoder::DCTMethod method, bool batched) {
+    Encoder encoder;
+    encoder.setVerbose(false);
+    encoder.setChromaSubsampling(subsampling);
+    encoder.setDCTMethod(method);
+    encoder.setBatchedDCT(batched);
+    return encodeWith(encoder, pipeline, image);
+}
+
+// the fused stages, the separate stages (main's --separate-stages), the streaming path and encode write the same file,
+// in every subsampling mode with a per-block and a batched DCT, for sizes that are and aren't multiples of the MCU size
+void testPipelines() {
+    const TestImage images[4] = { generateImage(64, 48, 3), generateImage(61, 37, 3), generateImage(1, 1, 3), generateImage(45, 70, 1) };
+    const Encoder::ChromaSubsampling modes[6] = { Encoder::AutomaticSubsampling, Encoder::Subsampling444, Encoder::Subsampling422,
+                                                  Encoder::Subsampling420, Encoder::Subsampling440, Encoder::Subsampling411 };
+
+    for (const TestImage& image : images) {
+        bool same = true;
+
+        for (Encoder::ChromaSubsampling mode : modes) {
+            for (int batched = 0; batched < 2; batched++) {
+                const Encoder::DCTMethod method = batched ? Encoder::IntegerDCT : Encoder::SeparableDCT;
+                const std::vector<uint8_t> fused = encodeWith(FusedStages, image, mode, method, batched);
+
+                same = same && !fused.empty() && encodeWith(SeparateStages, image, mode, method, batched) == fused
+                       && encodeWith(Streaming, image, mode, method, batched) == fused
+                       && encodeWith(CallerPixels, image, mode, method, batched) == fused;
+            }
+        }
+
+        check(same, std::to_string(image.width) + "x" + std::to_string(image.height) + (image.channels == 1 ? " gray" : "")
+                    + " image: separate stages, streaming and encode write the fused stages' file");
+    }
+}
+
+// an encoder that is reset and used again (for another image in between) writes the same file as the first time
+void testReset() {
+    const TestImage first = generateImage(61, 37, 3);
+    const TestImage other = generateImage(200, 120, 3);
+    const Pipeline pipelines[4] = { FusedStages, SeparateStages, Streaming, CallerPixels };
+    const char* names[4] = { "fused stages", "separate stages", "streaming", "encode" };
+
+    for (int p = 0; p < 4; p++) {
+        Encoder encoder;
+        encoder.setVerbose(false);
+        const std::vector<uint8_t> expected = encodeWith(encoder, pipelines[p], first);
+        encoder.reset();
+        encodeWith(encoder, pipelines[p], other);
+        encoder.reset();
+
+        check(!expected.empty() && encodeWith(encoder, pipelines[p], first) == expected,
+              std::string(names[p]) + ": a reset encoder writes the same file again");
+    }
+}
+
+// several threads encode different images with leased encoders at once: every file equals that of a fresh encoder,
+// and the pool never creates more encoders than there are threads
+void testEncoderPool() {
+    const int Threads = 4;
+    const int JobsPerThread = 8;
+    const TestImage images[4] = { generateImage(61, 37, 3), generateImage(200, 120, 3), generateImage(45, 70, 1), generateImage(16, 16, 3) };
+    std::vector<std::vector<uint8_t>> expected;
+
+    for (const TestImage& image : images) {
+        Encoder encoder;
+        encoder.setVerbose(false);
+        expected.push_back(encodeWith(encoder, CallerPixels, image));
+    }
+
+    EncoderPool pool([](Encoder& encoder) { encoder.setVerbose(false); });
+    std::vector<int> mismatches(Threads, 0);
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < Threads; t++) {
+        threads.emplace_back([&, t]() {
+            const std::string path = "tests_output_" + std::to_string(t) + ".jpg";
+
+            for (int job = 0; job < JobsPerThread; job++) {
+                const int i = (t + job) % 4;
+                EncoderPool::Lease encoder = pool.acquire();
+                mismatches[t] += encodeWith(*encoder, CallerPixels, images[i], path) != expected[i];
+            }
+        });
+    }
+
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    check(std::count(mismatches.begin(), mismatches.end(), 0) == Threads,
+          std::to_string(Threads) + " threads with pooled encoders write the same files as fresh encoders");
+    check(pool.createdCount() <= (size_t)Threads, "the pool created " + std::to_string(pool.createdCount()) + " encoders for "
+                                                   + std::to_string(Threads) + " threads");
+}
+
+// the rows of image copied stride bytes apart, the padding between them filled with garbage
+std::vector<uint8_t> padRows(const TestImage& image, size_t stride) {
+    const size_t rowBytes = (size_t)image.width * image.channels;
+    std::vector<uint8_t> padded(stride * image.height, 0xA5);
+
+    for (int y = 0; y < image.height; y++) {
+        std::copy(image.pixels.begin() + y * rowBytes, image.pixels.begin() + (y + 1) * rowBytes, padded.begin() + y * stride);
+    }
+
+    return padded;
+}
+
+// both encode overloads read rows stride bytes apart (0 for packed rows), and return false without writing a file
+// for invalid arguments
+void testEncodeArguments() {
+    const TestImage images[2] = { generateImage(61, 37, 3), generateImage(45, 70, 1) };
+    Encoder encoder;
+    encoder.setVerbose(false);
+
+    for (const TestImage& image : images) {
+        const Encoder::PixelFormat format = image.channels == 1 ? Encoder::Gray8 : Encoder::RGB24;
+        const size_t rowBytes = (size_t)image.width * image.channels;
+        const size_t stride = rowBytes + 37;
+        const std::vector<uint8_t> expected = encodeWith(encoder, CallerPixels, image);
+        std::vector<uint8_t> padded = padRows(image, stride);
+        bool same = !expected.empty();
+
+        same = same && encoder.encode(padded.data(), image.width, image.height, stride, format, OutputPath) && takeOutput() == expected;
+        same = same && encoder.encode(padded, image.width, image.height, stride, format, OutputPath) && takeOutput() == expected;
+        same = same && encoder.encode(image.pixels.data(), image.width, image.height, 0, format, OutputPath) && takeOutput() == expected;
+        same = same && encoder.encode(image.pixels, image.width, image.height, 0, format, OutputPath) && takeOutput() == expected;
+
+        // the last row needs no padding
+        padded.resize(stride * (image.height - 1) + rowBytes);
+        same = same && encoder.encode(padded, image.width, image.height, stride, format, OutputPath) && takeOutput() == expected;
+
+        check(same, std::to_string(image.width) + "x" + std::to_string(image.height) + (image.channels == 1 ? " gray" : "")
+                    + " image: rows " + std::to_string(stride) + " bytes apart and packed rows (stride 0) encode alike");
+    }
+
+    const TestImage& image = images[0];
+    const std::vector<uint8_t> large((size_t)(Encoder::MaxImageSize + 1) * 3, 0);
+    std::vector<uint8_t> truncated = image.pixels;
+    truncated.pop_back();
+    const size_t rowBytes = (size_t)image.width * 3;
+    const Encoder::PixelFormat rgb = Encoder::RGB24;
+    std::vector<bool> results;
+
+    results.push_back(encoder.encode(nullptr, image.width, image.height, rowBytes, rgb, OutputPath));
+    results.push_back(encoder.encode(image.pixels.data(), image.width, image.height, rowBytes - 1, rgb, OutputPath));
+    results.push_back(encoder.encode(image.pixels, image.width, image.height, rowBytes - 1, rgb, OutputPath));
+    results.push_back(encoder.encode(truncated, image.width, image.height, rowBytes, rgb, OutputPath));
+    results.push_back(encoder.encode(truncated, image.width, image.height, 0, rgb, OutputPath));
+    results.push_back(encoder.encode(std::vector<uint8_t>(), image.width, image.height, 0, rgb, OutputPath));
+    results.push_back(encoder.encode(image.pixels, 0, image.height, 0, rgb, OutputPath));
+    results.push_back(encoder.encode(image.pixels, image.width, 0, 0, rgb, OutputPath));
+    results.push_back(encoder.encode(image.pixels, -image.width, image.height, 0, rgb, OutputPath));
+    results.push_back(encoder.encode(image.pixels.data(), image.width, -image.height, 0, rgb, OutputPath));
+    results.push_back(encoder.encode(large, Encoder::MaxImageSize + 1, 1, 0, rgb, OutputPath));
+    results.push_back(encoder.encode(large, 1, Encoder::MaxImageSize + 1, 0, rgb, OutputPath));
+    results.push_back(encoder.encode(large.data(), Encoder::MaxImageSize + 1, 1, 0, rgb, OutputPath));
+    results.push_back(encoder.encode(large.data(), 1, Encoder::MaxImageSize + 1, 0, rgb, OutputPath));
+
+    check(std::count(results.begin(), results.end(), true) == 0 && !std::ifstream(OutputPath),
+          "encode returns false for no pixels, a short stride or vector, a size of 0 or a size above MaxImageSize");
+}
+
+// all 2^24 colors, packed RGB24 in the order of their 24-bit value
+std::vector<uint8_t> generateAllColors() {
+    std::vector<uint8_t> rgb(3 << 24);
+
+    for (uint32_t color = 0; color < 1u << 24; color++) {
+        rgb[3 * color] = (uint8_t)(color >> 16);
+        rgb[3 * color + 1] = (uint8_t)(color >> 8);
+        rgb[3 * color + 2] = (uint8_t)color;
+    }
+
+    return rgb;
+}
+
+void testColorTable(const std::vector<uint8_t>& colors) {
+    int maxDeviation = 0;
+
+    for (size_t i = 0; i < colors.size(); i += 3) {
+        const Encoder::RGB rgb(colors[i], colors[i + 1], colors[i + 2]);
+        const Encoder::YCbCr expected = Encoder::RGBToYCbCr(rgb);
+        const Encoder::YCbCr converted = Encoder::RGBToYCbCrWithTable(rgb);
+
+        maxDeviation = std::max(maxDeviation, std::abs(converted.y - expected.y));
+        maxDeviation = std::max(maxDeviation, std::abs(converted.cb - expected.cb));
+        maxDeviation = std::max(maxDeviation, std::abs(converted.cr - expected.cr));
+    }
+
+    check(maxDeviation <= 1, "table color conversion within 1 of RGBToYCbCr for all colors (max " + std::to_string(maxDeviation) + ")");
+}
+
+// a color kernel must equal RGBToYCbCrWithTable (and so be within 1 of RGBToYCbCr) for all colors;
+// they are converted in rows of every length up to 99 and then of odd length 4093, so the tail loops run too
+bool colorKernelMatches(Simd::ColorKernel kernel, const std::vector<uint8_t>& colors) {
+    const size_t pixelCount = colors.size() / 3;
+    std::vector<uint8_t> y(pixelCount), cb(pixelCount), cr(pixelCount);
+    size_t first = 0;
+
+    for (unsigned int length = 1; first < pixelCount; length = length < 99 ? length + 1 : 4093) {
+        const unsigned int count = (unsigned int)std::min<size_t>(length, pixelCount - first);
+        kernel(&colors[3 * first], &y[first], &cb[first], &cr[first], count);
+        first += count;
+    }
+
+    for (size_t i = 0; i < pixelCount; i++) {
+        const Encoder::YCbCr expected = Encoder::RGBToYCbCrWithTable(Encoder::RGB(colors[3 * i], colors[3 * i + 1], colors[3 * i + 2]));
+
+        if (y[i] != expected.y || cb[i] != expected.cb || cr[i] != expected.cr)
+            return false;
+    }
+
+    return true;
+}
+
+void testColorKernels(const std::vector<uint8_t>& colors) {
+    const Simd::ColorKernel scalar = Simd::colorKernel(Simd::Scalar);
+
+    for (Simd::InstructionSet set : supportedInstructionSets()) {
+        if (set == Simd::Scalar || Simd::colorKernel(set) != scalar)
+            check(colorKernelMatches(Simd::colorKernel(set), colors),
+                  std::string(Simd::instructionSetName(set)) + " color kernel equals RGBToYCbCrWithTable for all colors");
+    }
+}
+
+int main() {
+    const std::vector<Encoder::Block> samples = generateSampleBlocks();
+
+    std::cout << "detected instruction set: " << Simd::instructionSetName(Simd::detectedInstructionSet()) << std::endl;
+
+    testIntegerDCT(samples);
+    testIntegerDCTKernels(samples);
+    testFastIntegerDCTKernels(samples);
+    testIntegerDCTBatchKernels(samples);
+    testReciprocalQuantizer();
+    testQuantizeKernels();
+    testFlatBlocks();
+    testPipelines();
+    testReset();
+    testEncoderPool();
+    testEncodeArguments();
+
+    const std::vector<uint8_t> colors = generateAllColors();
+    testColorTable(colors);
+    testColorKernels(colors);
+
+    std::cout << (failures == 0 ? "all checks passed" : std::to_string(failures) + " checks failed") << std::endl;
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}